@@ -0,0 +1,109 @@
+#include "M2XBatchController.h"
+
+M2XBatchController::M2XBatchController(int buffer_size,
+                                       int min_batch,
+                                       int max_batch,
+                                       unsigned long target_latency_millis)
+    : _buffer_size(buffer_size),
+      _min_batch((min_batch > 0) ? min_batch : 1),
+      _max_batch(max_batch),
+      _target_latency_millis(target_latency_millis),
+      _batch((min_batch > 0) ? min_batch : 1),
+      _bytes_per_sample(0),
+      _overhead(0),
+      _measured(0),
+      _last_samples(0),
+      _last_length(0),
+      _throughput(0) {
+}
+
+int M2XBatchController::batchSize() {
+  return _batch;
+}
+
+void M2XBatchController::record(M2XNanodeClient* client, int samples, int status) {
+  record(client->lastLatencyMillis(), client->lastRequestLength(),
+         samples, status);
+}
+
+void M2XBatchController::record(unsigned long latency_millis, int request_length,
+                                int samples, int status) {
+  unsigned long throughput;
+  int per_sample, overhead;
+
+  if ((samples > 0) && (request_length > 0)) {
+    if ((_last_samples > 0) && (_last_samples != samples) &&
+        (request_length > _last_length) == (samples > _last_samples)) {
+      // Two requests of different sizes give the per value cost. Values
+      // vary in length, so a single pair can be far off: once measured,
+      // the cost only ever grows, rounded up
+      per_sample = (request_length - _last_length) / (samples - _last_samples);
+      if ((request_length - _last_length) % (samples - _last_samples) != 0) {
+        per_sample++;
+      }
+      if (!_measured || (per_sample > _bytes_per_sample)) {
+        _bytes_per_sample = per_sample;
+        _overhead = 0;
+      }
+      _measured = 1;
+    } else if (_bytes_per_sample == 0) {
+      // Only one size seen so far, charge everything to the values
+      _bytes_per_sample = (request_length + samples - 1) / samples;
+      _overhead = 0;
+    }
+    // The fixed cost covers the largest request seen so far, so the cap
+    // never rises above a size that was actually measured plus one value
+    overhead = request_length - samples * _bytes_per_sample;
+    if (overhead > _overhead) { _overhead = overhead; }
+    _last_samples = samples;
+    _last_length = request_length;
+  }
+
+  if ((status < 200) || (status >= 300)) {
+    // Timeouts and errors: back off quickly
+    _batch /= 2;
+  } else if (latency_millis > _target_latency_millis) {
+    _batch = _batch * 3 / 4;
+  } else {
+    if (latency_millis > 0) {
+      throughput = (unsigned long) samples * 100000UL / latency_millis;
+      // Exponential moving average with a weight of 1/4
+      _throughput = (_throughput == 0) ? throughput :
+          (_throughput * 3 + throughput) / 4;
+    }
+    _batch++;
+  }
+  clamp();
+}
+
+unsigned long M2XBatchController::samplesPerSecondX100() {
+  return _throughput;
+}
+
+int M2XBatchController::bytesPerSample() {
+  return _bytes_per_sample;
+}
+
+int M2XBatchController::requestOverhead() {
+  return _overhead;
+}
+
+int M2XBatchController::maxBatchForBuffer() {
+  int available = _buffer_size - kPacketHeaderSize - _overhead;
+  if (_bytes_per_sample <= 0) { return _max_batch; }
+  if (_measured) {
+    // One value worth of headroom absorbs values longer than any seen
+    // yet. Before that, the fixed cost is charged to the values, which
+    // is safe already.
+    available -= _bytes_per_sample;
+  }
+  if (available <= 0) { return _min_batch; }
+  return available / _bytes_per_sample;
+}
+
+void M2XBatchController::clamp() {
+  int limit = maxBatchForBuffer();
+  if (limit > _max_batch) { limit = _max_batch; }
+  if (_batch > limit) { _batch = limit; }
+  if (_batch < _min_batch) { _batch = _min_batch; }
+}
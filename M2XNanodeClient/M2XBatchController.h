@@ -0,0 +1,63 @@
+#ifndef M2XBatchController_h
+#define M2XBatchController_h
+
+#include "M2XNanodeClient.h"
+
+// Bytes of Ethernet, IP and TCP headers in front of the request in
+// Ethernet::buffer
+const int kPacketHeaderSize PROGMEM = 54;
+
+// Picks the number of values sent per +postStreamValues+ or
+// +postDeviceUpdates+ request. The batch grows by one after each fast
+// enough request, and shrinks when a request is slow or fails, while
+// always staying small enough to fit in Ethernet::buffer.
+class M2XBatchController {
+public:
+  // +buffer_size+ is the size of Ethernet::buffer. Requests taking longer
+  // than +target_latency_millis+ make the batch shrink.
+  M2XBatchController(int buffer_size,
+                     int min_batch = 1,
+                     int max_batch = 32,
+                     unsigned long target_latency_millis = 2000);
+
+  // Number of values to send in the next request
+  int batchSize();
+
+  // Records the outcome of a request carrying +samples+ values, latency
+  // and request size are taken from the client.
+  void record(M2XNanodeClient* client, int samples, int status);
+
+  void record(unsigned long latency_millis, int request_length,
+              int samples, int status);
+
+  // Smoothed throughput of successful requests, in samples per second
+  // multiplied by 100
+  unsigned long samplesPerSecondX100();
+
+  // Upper estimates of the request bytes added by each value, and of the
+  // bytes used by the request regardless of the number of values. Both
+  // only grow as requests are recorded.
+  int bytesPerSample();
+  int requestOverhead();
+
+  // Largest batch that still fits in Ethernet::buffer according to the
+  // current estimates, keeping one value worth of headroom
+  int maxBatchForBuffer();
+
+private:
+  int _buffer_size;
+  int _min_batch;
+  int _max_batch;
+  unsigned long _target_latency_millis;
+  int _batch;
+  int _bytes_per_sample;
+  int _overhead;
+  uint8_t _measured;
+  int _last_samples;
+  int _last_length;
+  unsigned long _throughput;
+
+  void clamp();
+};
+
+#endif  /* M2XBatchController_h */
@@ -0,0 +1,147 @@
+#include "M2XLocationTracker.h"
+
+// cos() of 0, 5, 10, ..., 90 degrees in Q15 fixed point
+static const uint16_t kCosTable[] PROGMEM = {
+  32767, 32642, 32269, 31650, 30791, 29697, 28377, 26841, 25101, 23170,
+  21062, 18794, 16384, 13848, 11207, 8481, 5690, 2856, 0
+};
+
+static const int32_t kMicrodegreesPerStep = 5000000;
+
+// Returns cos() of the latitude in Q15, using linear interpolation
+// between table entries
+static uint16_t cos_q15(int32_t latitude) {
+  uint32_t abs_latitude = (latitude < 0) ? -latitude : latitude;
+  uint16_t index, c0, c1;
+  uint32_t fraction;
+
+  if (abs_latitude >= 90000000UL) { return 0; }
+  index = abs_latitude / kMicrodegreesPerStep;
+  // In units of 1/1000 step, so the product below fits in 32 bits
+  fraction = (abs_latitude % kMicrodegreesPerStep) / 5000;
+  c0 = pgm_read_word(&kCosTable[index]);
+  c1 = pgm_read_word(&kCosTable[index + 1]);
+  return c0 - (uint16_t) (((uint32_t) (c0 - c1) * fraction) / 1000);
+}
+
+// One microdegree of latitude is 0.111319 meters, 57 / 512 is close
+// enough, and dividing by 8 first keeps 360 degrees within 32 bits
+static uint32_t microdegrees_to_meters(uint32_t microdegrees) {
+  return ((microdegrees >> 3) * 57UL) >> 6;
+}
+
+static uint32_t isqrt(uint32_t value) {
+  uint32_t result = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > value) { bit >>= 2; }
+  while (bit != 0) {
+    if (value >= result + bit) {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    } else {
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return result;
+}
+
+M2XLocationTracker::M2XLocationTracker(uint16_t min_distance_meters,
+                                       uint16_t min_heading_degrees,
+                                       unsigned long max_interval_millis)
+    : _min_distance_meters(min_distance_meters),
+      _min_heading_degrees(min_heading_degrees),
+      _max_interval_millis(max_interval_millis),
+      _has_last(0) {
+}
+
+uint32_t M2XLocationTracker::distanceMeters(int32_t latitude1, int32_t longitude1,
+                                            int32_t latitude2, int32_t longitude2) {
+  int32_t dlat = latitude2 - latitude1;
+  int32_t dlon = longitude2 - longitude1;
+  uint32_t dx, dy, lon_meters, larger, smaller;
+  uint16_t c;
+
+  if (dlat < 0) { dlat = -dlat; }
+  if (dlon < 0) { dlon = -dlon; }
+  // Take the short way around the antimeridian
+  if (dlon > 180000000L) { dlon = 360000000L - dlon; }
+
+  dy = microdegrees_to_meters(dlat);
+  lon_meters = microdegrees_to_meters(dlon);
+  c = cos_q15(latitude1 / 2 + latitude2 / 2);
+  // Split multiplication so the Q15 product never overflows
+  dx = (lon_meters >> 15) * c + (((lon_meters & 0x7FFF) * c) >> 15);
+
+  if ((dx < 46340UL) && (dy < 46340UL)) {
+    return isqrt(dx * dx + dy * dy);
+  }
+  // Squares would overflow here, use the octagonal approximation
+  larger = (dx > dy) ? dx : dy;
+  smaller = (dx > dy) ? dy : dx;
+  return larger + (smaller * 3) / 8;
+}
+
+int M2XLocationTracker::shouldSend(int32_t latitude, int32_t longitude, int heading) {
+  int diff;
+
+  if (!_has_last) { return 1; }
+  if ((_max_interval_millis > 0) &&
+      (millis() - _last_millis >= _max_interval_millis)) {
+    return 1;
+  }
+  if ((_min_heading_degrees > 0) && (heading >= 0) && (_last_heading >= 0)) {
+    diff = (heading - _last_heading) % 360;
+    if (diff < 0) { diff += 360; }
+    if (diff > 180) { diff = 360 - diff; }
+    if (diff >= (int) _min_heading_degrees) { return 1; }
+  }
+  return distanceMeters(_last_latitude, _last_longitude,
+                        latitude, longitude) >= _min_distance_meters;
+}
+
+void M2XLocationTracker::markSent(int32_t latitude, int32_t longitude, int heading) {
+  _has_last = 1;
+  _last_latitude = latitude;
+  _last_longitude = longitude;
+  _last_heading = heading;
+  _last_millis = millis();
+}
+
+int M2XLocationTracker::updateLocation(M2XNanodeClient* client, const char* device_id,
+                                       int32_t latitude, int32_t longitude, int heading,
+                                       int has_name, int has_elevation,
+                                       update_location_data_fill_callback cb) {
+  int status;
+
+  if (!shouldSend(latitude, longitude, heading)) {
+    return E_SUPPRESSED;
+  }
+  status = client->updateLocation(device_id, has_name, has_elevation, cb);
+  if ((status >= 200) && (status < 300)) {
+    markSent(latitude, longitude, heading);
+  }
+  return status;
+}
+
+void M2XLocationTracker::reset() {
+  _has_last = 0;
+}
+
+void M2XLocationTracker::printMicrodegrees(Print* print, int32_t value) {
+  uint32_t abs_value, fraction, divisor;
+
+  if (value < 0) {
+    print->print('-');
+    abs_value = -value;
+  } else {
+    abs_value = value;
+  }
+  print->print(abs_value / 1000000UL);
+  print->print('.');
+  fraction = abs_value % 1000000UL;
+  for (divisor = 100000UL; divisor > 0; divisor /= 10) {
+    print->print((char) ('0' + (fraction / divisor) % 10));
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef M2XLocationTracker_h
+#define M2XLocationTracker_h
+
+#include "M2XNanodeClient.h"
+
+// Sits in front of +updateLocation+ and only lets a location update
+// through when the device has actually moved. All coordinates are in
+// microdegrees (degrees * 1000000), so no floating point math is needed.
+class M2XLocationTracker {
+public:
+  // An update is sent when one of the following conditions is met:
+  // 1. The device moved at least +min_distance_meters+ since the last
+  //    location sent;
+  // 2. The heading changed at least +min_heading_degrees+, use 0 to
+  //    ignore heading changes;
+  // 3. +max_interval_millis+ passed since the last location sent, use 0
+  //    to disable this.
+  M2XLocationTracker(uint16_t min_distance_meters = 50,
+                     uint16_t min_heading_degrees = 0,
+                     unsigned long max_interval_millis = 600000);
+
+  // Returns 1 if a location update should be sent for this fix, 0
+  // otherwise. Use -1 as +heading+ if it is not known.
+  int shouldSend(int32_t latitude, int32_t longitude, int heading = -1);
+
+  // Records the fix as the last location sent
+  void markSent(int32_t latitude, int32_t longitude, int heading = -1);
+
+  // Calls +updateLocation+ on the client if the fix passes +shouldSend+,
+  // and returns its HTTP status code. E_SUPPRESSED is returned if no
+  // request was needed. The callback is used the same way as in
+  // +M2XNanodeClient::updateLocation+, +printMicrodegrees+ can be used
+  // there to print the same fix.
+  int updateLocation(M2XNanodeClient* client, const char* device_id,
+                     int32_t latitude, int32_t longitude, int heading,
+                     int has_name, int has_elevation,
+                     update_location_data_fill_callback cb);
+
+  // Forgets the last location sent, so the next fix is always sent
+  void reset();
+
+  // Distance in meters between 2 points using the equirectangular
+  // approximation. The error is below 1% for points less than 40km
+  // apart, and grows to around 8% beyond that.
+  static uint32_t distanceMeters(int32_t latitude1, int32_t longitude1,
+                                 int32_t latitude2, int32_t longitude2);
+
+  // Prints microdegrees as decimal degrees, e.g. 37775000 as 37.775000
+  static void printMicrodegrees(Print* print, int32_t value);
+
+private:
+  uint16_t _min_distance_meters;
+  uint16_t _min_heading_degrees;
+  unsigned long _max_interval_millis;
+  int _has_last;
+  int32_t _last_latitude;
+  int32_t _last_longitude;
+  int _last_heading;
+  unsigned long _last_millis;
+};
+
+#endif  /* M2XLocationTracker_h */
@@ -1,7 +1,20 @@
 #include "M2XNanodeClient.h"
+#include "M2XTrafficRecorder.h"
 
 #include <EtherCard.h>
 
+// Host and gateway builds scan responses 16 or 32 bytes at a time, the
+// AVR build keeps the compact scalar loop. Define M2X_SCAN_SCALAR to use
+// the scalar loop everywhere.
+#if !defined(__AVR__) && !defined(M2X_SCAN_SCALAR) && defined(__SSE2__)
+#define M2X_SCAN_SIMD
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define M2X_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
 int print_encoded_string(Print* print, const char* str);
 int tolower(int ch)
 {
@@ -17,12 +30,21 @@ M2XNanodeClient::M2XNanodeClient(const char* key,
                                  int timeout_seconds,
                                  int case_insensitive,
                                  int port) : _key(key),
-                                             _addr(addr),
                                              _timeout_seconds(timeout_seconds),
                                              _case_insensitive(case_insensitive),
-                                             _port(port) {
+                                             _addr(addr),
+                                             _port(port),
+                                             _last_latency_millis(0),
+                                             _endpoints(NULL),
+                                             _endpoint_count(0) {
 }
 
+// An endpoint that failed is skipped for this long times the number of
+// failures in a row (up to 8 times)
+static const unsigned long kEndpointRetryMillis = 30000;
+// Shortest timeout used when failing over based on measured latency
+static const unsigned long kMinEndpointTimeoutMillis = 1000;
+
 static M2XNanodeClient* s_client;
 static const char* s_device_id;
 static const char* s_stream_name;
@@ -32,6 +54,8 @@ static int s_timestamp_type;
 static put_data_fill_callback s_put_cb;
 static int s_fd;
 static int s_response_code;
+static uint16_t s_request_length;
+static M2XTrafficRecorder* s_recorder;
 static char* s_response_buffer;
 static int* s_response_buffer_length;
 
@@ -49,6 +73,43 @@ static update_location_data_fill_callback s_update_location_data_cb;
 
 static delete_values_timestamp_fill_callback s_delete_cb;
 
+static const char* s_fixed_request_line;
+static const char* s_fixed_layout;
+static int s_fixed_length;
+// Slot counts of the last fixed layout sent, layouts live in PROGMEM and
+// never change, so they are only counted once
+static const char* s_counted_layout;
+static int s_counted_value_slots;
+static int s_counted_timestamp_slots;
+
+// Client owning the open beginUpdate scope, NULL when there is none
+static M2XNanodeClient* s_combining;
+// Number of nested beginUpdate calls of that client
+static int s_combining_depth;
+static int s_combined_number;
+static int s_combined_status;
+static const char* s_combined_device_id;
+static const char* s_combined_stream_names[M2X_COMBINE_MAX_STREAMS];
+static put_data_fill_callback s_combined_cbs[M2X_COMBINE_MAX_STREAMS];
+
+// Remembers the request just built, for +lastRequestLength+ and the
+// traffic recorder
+static void finish_request(BufferFiller* bfill) {
+  s_request_length = bfill->position();
+  if (s_recorder) {
+    s_recorder->record(kSegmentRequest, bfill->buffer(), s_request_length);
+  }
+}
+
+static void record_response(uint8_t statuscode, uint16_t datapos, uint16_t len_of_data) {
+  if (s_recorder == NULL) { return; }
+  if (statuscode == 0) {
+    s_recorder->record(kSegmentResponse, ether.buffer + datapos, len_of_data);
+  } else {
+    s_recorder->record(kSegmentError, &statuscode, 1);
+  }
+}
+
 static uint16_t put_client_internal_datafill_cb(uint8_t fd) {
   BufferFiller bfill = EtherCard::tcpOffset();
   NullPrint null_print;
@@ -69,6 +130,7 @@ static uint16_t put_client_internal_datafill_cb(uint8_t fd) {
     bfill.print(F("{\"value\":\""));
     s_put_cb(&bfill);
     bfill.print(F("\"}"));
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -136,6 +198,38 @@ static void print_post_multiple_values_one_device(
   print->print("}}");
 }
 
+static int combined_stream_cb(Print* print, int stream_index) {
+  print->print("\"");
+  print->print(s_combined_stream_names[stream_index]);
+  print->print("\"");
+  return 1;
+}
+
+static void combined_data_cb(Print* print, int value_index, int stream_index) {
+  // Keeps the same quoting as the PUT request used by updateStreamValue
+  print->print("\"");
+  s_combined_cbs[stream_index](print);
+  print->print("\"");
+}
+
+// Prints a PROGMEM layout built with the M2X_FIXED_* macros, filling
+// in values at the placeholders
+static void print_fixed_layout(Print* print, const char* layout,
+                               put_data_fill_callback timestamp_cb,
+                               post_multiple_data_fill_callback data_cb) {
+  int si = 0;
+  char c;
+  for (; (c = pgm_read_byte(layout)) != '\0'; layout++) {
+    if (c == M2X_FIXED_VALUE_SLOT[0]) {
+      data_cb(print, 0, si++);
+    } else if (c == M2X_FIXED_TIMESTAMP_SLOT[0]) {
+      timestamp_cb(print);
+    } else {
+      print->print(c);
+    }
+  }
+}
+
 static void print_location(Print* print, int has_name, int has_elevation,
                            update_location_data_fill_callback cb) {
   print->print(F("{"));
@@ -186,6 +280,7 @@ static uint16_t post_client_internal_datafill_cb(uint8_t fd) {
     s_client->writeHttpHeader(&bfill, null_print.count);
 
     print_post_values(&bfill, s_number, s_post_timestamp_cb, s_post_data_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -208,6 +303,7 @@ static uint16_t post_multiple_client_internal_datafill_cb(uint8_t fd) {
     print_post_multiple_values(&bfill, s_number, s_post_multiple_stream_cb,
                                s_post_multiple_timestamp_cb,
                                s_post_multiple_data_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -230,6 +326,29 @@ static uint16_t post_single_device_internal_datafill_cb(uint8_t fd) {
     print_post_multiple_values_one_device(&bfill, s_number, s_put_cb,
                                           s_post_multiple_stream_cb,
                                           s_post_multiple_data_cb);
+    finish_request(&bfill);
+  }
+  return bfill.position();
+}
+
+static uint16_t post_fixed_layout_internal_datafill_cb(uint8_t fd) {
+  BufferFiller bfill = EtherCard::tcpOffset();
+  NullPrint null_print;
+  int si;
+
+  if (fd == s_fd) {
+    bfill.println((const __FlashStringHelper*) s_fixed_request_line);
+
+    // Only the values need measuring, the rest is a constant
+    null_print.count = 0;
+    if (s_put_cb) { s_put_cb(&null_print); }
+    for (si = 0; si < s_number; si++) {
+      s_post_multiple_data_cb(&null_print, 0, si);
+    }
+    s_client->writeHttpHeader(&bfill, s_fixed_length + null_print.count);
+
+    print_fixed_layout(&bfill, s_fixed_layout, s_put_cb, s_post_multiple_data_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -248,6 +367,7 @@ static uint16_t update_location_internal_datafill_cb(uint8_t fd) {
     s_client->writeHttpHeader(&bfill, null_print.count);
 
     print_location(&bfill, s_has_name, s_has_elevation, s_update_location_data_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -268,6 +388,7 @@ static uint16_t delete_client_internal_datafill_cb(uint8_t fd) {
     s_client->writeHttpHeader(&bfill, null_print.count);
 
     print_delete_values(&bfill, s_delete_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -290,6 +411,7 @@ static uint16_t post_command_internal_datafill_cb(uint8_t fd) {
     s_client->writeHttpHeader(&bfill, null_print.count);
 
     print_command_body(&bfill, s_put_cb);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
@@ -313,18 +435,25 @@ static uint16_t get_timestamp_internal_datafill_cb(uint8_t fd) {
     }
     bfill.println(F(" HTTP/1.0"));
     s_client->writeHttpHeader(&bfill, 0);
+    finish_request(&bfill);
   }
   return bfill.position();
 }
 
+// Returning 1 from a result callback tells ethercard to send FIN right
+// away instead of waiting for the server to close the connection.
 static uint8_t client_internal_fetch_response_code_cb(uint8_t fd, uint8_t statuscode, uint16_t datapos, uint16_t len_of_data) {
   if (fd == s_fd) {
+    record_response(statuscode, datapos, len_of_data);
     if (statuscode == 0) {
       s_response_code = s_client->readStatusCode((char*) ether.buffer + datapos, len_of_data);
     } else {
       s_response_code = statuscode;
     }
+    // The status code is all we need here
+    return 1;
   }
+  return 0;
 }
 
 static int fill_buffer_with_body(const char* data, int length) {
@@ -352,6 +481,7 @@ static uint8_t client_internal_fetch_code_and_body_cb(uint8_t fd, uint8_t status
   int ret;
 
   if (fd == s_fd) {
+    record_response(statuscode, datapos, len_of_data);
     if (statuscode == 0) {
       origin = (char*) ether.buffer + datapos;
       s_response_code = s_client->readStatusCode(origin, len_of_data);
@@ -364,185 +494,213 @@ static uint8_t client_internal_fetch_code_and_body_cb(uint8_t fd, uint8_t status
     } else {
       s_response_code = statuscode;
     }
+    // The body of the timestamp response fits in the first packet
+    return 1;
+  }
+  return 0;
+}
+
+void M2XNanodeClient::beginUpdate() {
+  // The buffer is shared, only one client can own it at a time
+  if ((s_combining != NULL) && (s_combining != this)) { return; }
+  if (s_combining == this) {
+    // Nested scope, e.g. a scheduler flushed inside the sketch's own
+    // scope: values buffered so far are sent, not dropped
+    flushCombined();
+    s_combining_depth++;
+    return;
+  }
+  s_combining = this;
+  s_combining_depth = 1;
+  s_combined_number = 0;
+  s_combined_status = E_OK;
+}
+
+int M2XNanodeClient::commitUpdate() {
+  if (s_combining != this) { return E_OK; }
+  flushCombined();
+  if (--s_combining_depth == 0) {
+    s_combining = NULL;
+  }
+  return s_combined_status;
+}
+
+void M2XNanodeClient::flushCombined() {
+  int status;
+  if (s_combined_number == 0) { return; }
+  status = postDeviceUpdate(s_combined_device_id, s_combined_number, NULL,
+                            combined_stream_cb, combined_data_cb);
+  s_combined_number = 0;
+  // Keep the first failure, so it is not hidden by later requests
+  if ((s_combined_status == E_OK) ||
+      ((s_combined_status >= 200) && (s_combined_status < 300))) {
+    s_combined_status = status;
   }
 }
 
 int M2XNanodeClient::updateStreamValue(const char* device_id, const char* stream_name,
                                        put_data_fill_callback cb) {
   int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
+  if (s_combining == this) {
+    if ((s_combined_number > 0) &&
+        (strcmp(s_combined_device_id, device_id) != 0)) {
+      flushCombined();
+    }
+    for (i = 0; i < s_combined_number; i++) {
+      if (strcmp(s_combined_stream_names[i], stream_name) == 0) {
+        // Later value for the same stream wins
+        s_combined_cbs[i] = cb;
+        return E_OK;
+      }
+    }
+    if (s_combined_number >= M2X_COMBINE_MAX_STREAMS) {
+      flushCombined();
+    }
+    s_combined_device_id = device_id;
+    s_combined_stream_names[s_combined_number] = stream_name;
+    s_combined_cbs[s_combined_number] = cb;
+    s_combined_number++;
+    return E_OK;
   }
+
   s_client = this;
   s_device_id = device_id;
   s_stream_name = stream_name;
   s_put_cb = cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            put_client_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     put_client_internal_datafill_cb);
 }
 
 int M2XNanodeClient::postStreamValues(const char* device_id, const char* stream_name, int value_number,
                                       post_data_fill_callback timestamp_cb,
                                       post_data_fill_callback data_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_stream_name = stream_name;
   s_number = value_number;
   s_post_timestamp_cb = timestamp_cb;
   s_post_data_cb = data_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            post_client_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_client_internal_datafill_cb);
 }
 
 int M2XNanodeClient::postDeviceUpdates(const char* device_id, int stream_number,
                                        post_multiple_stream_fill_callback stream_cb,
                                        post_multiple_data_fill_callback timestamp_cb,
                                        post_multiple_data_fill_callback data_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_number = stream_number;
   s_post_multiple_stream_cb = stream_cb;
   s_post_multiple_timestamp_cb = timestamp_cb;
   s_post_multiple_data_cb = data_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            post_multiple_client_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_multiple_client_internal_datafill_cb);
 }
 
 int M2XNanodeClient::postDeviceUpdate(const char* device_id, int stream_number,
                                       put_data_fill_callback timestamp_cb,
                                       post_multiple_stream_fill_callback stream_cb,
                                       post_multiple_data_fill_callback data_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_number = stream_number;
   s_put_cb = timestamp_cb;
   s_post_multiple_stream_cb = stream_cb;
   s_post_multiple_data_cb = data_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            post_single_device_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_single_device_internal_datafill_cb);
 }
 
+int M2XNanodeClient::postFixedLayout(const char* request_line, const char* layout,
+                                     int layout_length,
+                                     put_data_fill_callback timestamp_cb,
+                                     post_multiple_data_fill_callback data_cb) {
+  int i, value_slots, timestamp_slots;
+  char c;
+  // Slots are counted from the layout itself, so a wrong callback can
+  // never be called and Content-Length always matches the body
+  if (layout != s_counted_layout) {
+    s_counted_value_slots = 0;
+    s_counted_timestamp_slots = 0;
+    for (i = 0; i < layout_length; i++) {
+      c = pgm_read_byte(layout + i);
+      if (c == M2X_FIXED_VALUE_SLOT[0]) {
+        s_counted_value_slots++;
+      } else if (c == M2X_FIXED_TIMESTAMP_SLOT[0]) {
+        s_counted_timestamp_slots++;
+      }
+    }
+    s_counted_layout = layout;
+  }
+  value_slots = s_counted_value_slots;
+  timestamp_slots = s_counted_timestamp_slots;
+  if ((data_cb == NULL) && (value_slots > 0)) { return E_INVALID; }
+  if (timestamp_slots != (timestamp_cb ? 1 : 0)) { return E_INVALID; }
+
+  s_client = this;
+  s_fixed_request_line = request_line;
+  s_fixed_layout = layout;
+  s_fixed_length = layout_length - value_slots - timestamp_slots;
+  s_number = value_slots;
+  s_put_cb = timestamp_cb;
+  s_post_multiple_data_cb = data_cb;
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_fixed_layout_internal_datafill_cb);
+}
 
 int M2XNanodeClient::updateLocation(const char* device_id, int has_name, int has_elevation,
                                     update_location_data_fill_callback cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_has_name = has_name;
   s_has_elevation = has_elevation;
   s_update_location_data_cb = cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            update_location_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     update_location_internal_datafill_cb);
 }
 
 int M2XNanodeClient::deleteValues(const char* device_id, const char* stream_name,
                                   delete_values_timestamp_fill_callback timestamp_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_stream_name = stream_name;
   s_delete_cb = timestamp_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            delete_client_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     delete_client_internal_datafill_cb);
 }
 
 int M2XNanodeClient::markCommandProcessed(const char* device_id,
                                           const char* command_id,
                                           put_data_fill_callback body_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_command_id = command_id;
   s_command_action = "process";
   s_put_cb = body_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            post_command_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_command_internal_datafill_cb);
 }
 
 int M2XNanodeClient::markCommandRejected(const char* device_id,
                                          const char* command_id,
                                          put_data_fill_callback body_cb) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_device_id = device_id;
   s_command_id = command_id;
   s_command_action = "reject";
   s_put_cb = body_cb;
-  s_response_code = 0;
-  s_fd = ether.clientTcpReq(client_internal_fetch_response_code_cb,
-                            post_command_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_response_code_cb,
+                     post_command_internal_datafill_cb);
 }
 
 int M2XNanodeClient::getTimestamp(char* buffer, int* bufferLength, int type) {
-  int i;
-  ether.packetLoop(ether.packetReceive());
-  for (i = 0; i < 4; i++) {
-    ether.hisip[i] = (*_addr)[i];
-  }
   s_client = this;
   s_timestamp_type = type;
-  s_response_code = 0;
   s_response_buffer = buffer;
   s_response_buffer_length = bufferLength;
-  s_fd = ether.clientTcpReq(client_internal_fetch_code_and_body_cb,
-                            get_timestamp_internal_datafill_cb,
-                            _port);
-  return loop();
+  return sendRequest(client_internal_fetch_code_and_body_cb,
+                     get_timestamp_internal_datafill_cb);
 }
 
 int M2XNanodeClient::getTimestampSeconds(int32_t* ts) {
@@ -562,6 +720,14 @@ int M2XNanodeClient::getTimestampSeconds(int32_t* ts) {
   return status;
 }
 
+unsigned long M2XNanodeClient::lastLatencyMillis() {
+  return _last_latency_millis;
+}
+
+int M2XNanodeClient::lastRequestLength() {
+  return s_request_length;
+}
+
 // Encodes and prints string using Percent-encoding specified
 // in RFC 1738, Section 2.2
 int print_encoded_string(Print* print, const char* str) {
@@ -595,29 +761,146 @@ void M2XNanodeClient::writeHttpHeader(Print* print, int content_length) {
   print->println();
 }
 
-int M2XNanodeClient::waitForString(const char* origin, int len, const char* str) {
-  int i, j, k, cmp;
-  if (str[0] == '\0') { return 0; }
-  for (i = 0; i < len; i++) {
-    for (j = i, k = 0; (j < len) && (str[k] != '\0'); j++, k++) {
-      if (_case_insensitive) {
-        cmp = tolower(origin[j]) - tolower(str[k]);
-      } else {
-        cmp = origin[j] - str[k];
-      }
-      if ((str[k] != '*') && (cmp != 0)) {
-        // No match
-        break;
-      }
+// Returns the index right after +str+ if it matches +origin+ at index
+// +i+, or -1 otherwise. In the pattern, '*' matches any character.
+static int match_at(const char* origin, int len, int i, const char* str,
+                    int case_insensitive) {
+  int j, k, cmp;
+  for (j = i, k = 0; (j < len) && (str[k] != '\0'); j++, k++) {
+    if (case_insensitive) {
+      cmp = tolower(origin[j]) - tolower(str[k]);
+    } else {
+      cmp = origin[j] - str[k];
     }
-    if (str[k] == '\0') {
-      // Full match
-      return j;
+    if ((str[k] != '*') && (cmp != 0)) {
+      // No match
+      return -1;
     }
   }
+  // Full match only if the whole pattern was consumed
+  return (str[k] == '\0') ? j : -1;
+}
+
+static int wait_for_string_scalar(const char* origin, int len, int start,
+                                  const char* str, int case_insensitive) {
+  int i, ret;
+  for (i = start; i < len; i++) {
+    ret = match_at(origin, len, i, str, case_insensitive);
+    if (ret >= 0) { return ret; }
+  }
   return E_NOMATCH;
 }
 
+#ifdef M2X_SCAN_SIMD
+// Same as tolower() above on every byte: adds 0x20 to 'A' - 'Z' only.
+// Shifting 'A' - 'Z' to -128 - -103 lets a signed compare find them.
+static inline __m128i fold_case_16(__m128i v) {
+  __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char) (0x80 - 'A')));
+  __m128i upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char) (0x80 + 26)));
+  return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+#ifdef M2X_SCAN_AVX2
+static inline __m256i fold_case_32(__m256i v) {
+  __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char) (0x80 - 'A')));
+  __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 26)), shifted);
+  return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+#endif
+
+// Pattern of up to 16 bytes, prepared for comparing a whole candidate
+// position with one vector compare
+struct simd_pattern {
+  __m128i bytes;
+  // 0xFF where any byte matches: wildcards and bytes past the pattern
+  __m128i ignored;
+  int length;
+};
+
+// Checks one candidate position found by the first byte scan
+static inline int simd_match_at(const char* origin, int len, int i,
+                                const char* str, const simd_pattern& pattern,
+                                int case_insensitive) {
+  __m128i v, eq;
+  if (i + 16 > len) {
+    // Not enough bytes left for a full vector load
+    return match_at(origin, len, i, str, case_insensitive);
+  }
+  v = _mm_loadu_si128((const __m128i*) (origin + i));
+  if (case_insensitive) { v = fold_case_16(v); }
+  eq = _mm_or_si128(_mm_cmpeq_epi8(v, pattern.bytes), pattern.ignored);
+  return (_mm_movemask_epi8(eq) == 0xFFFF) ? (i + pattern.length) : -1;
+}
+
+// Finds candidates by comparing the first pattern byte against a whole
+// vector of input, then checks each candidate with one more compare.
+// Candidates are checked in order, so the result is the same as the
+// scalar loop.
+static int wait_for_string_simd(const char* origin, int len, const char* str,
+                                int case_insensitive) {
+  char bytes[16], ignored[16];
+  simd_pattern pattern;
+  unsigned int mask;
+  int i, k, ret;
+  __m128i first, v;
+
+  pattern.length = strlen(str);
+  if ((pattern.length > 16) || (str[0] == '*')) {
+    return wait_for_string_scalar(origin, len, 0, str, case_insensitive);
+  }
+  for (k = 0; k < 16; k++) {
+    if ((k < pattern.length) && (str[k] != '*')) {
+      bytes[k] = case_insensitive ? tolower(str[k]) : str[k];
+      ignored[k] = 0;
+    } else {
+      bytes[k] = 0;
+      ignored[k] = (char) 0xFF;
+    }
+  }
+  pattern.bytes = _mm_loadu_si128((const __m128i*) bytes);
+  pattern.ignored = _mm_loadu_si128((const __m128i*) ignored);
+
+  i = 0;
+#ifdef M2X_SCAN_AVX2
+  __m256i first32 = _mm256_set1_epi8(bytes[0]);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v32 = _mm256_loadu_si256((const __m256i*) (origin + i));
+    if (case_insensitive) { v32 = fold_case_32(v32); }
+    mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v32, first32));
+    while (mask != 0) {
+      ret = simd_match_at(origin, len, i + __builtin_ctz(mask), str,
+                          pattern, case_insensitive);
+      if (ret >= 0) { return ret; }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  first = _mm_set1_epi8(bytes[0]);
+  for (; i + 16 <= len; i += 16) {
+    v = _mm_loadu_si128((const __m128i*) (origin + i));
+    if (case_insensitive) { v = fold_case_16(v); }
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, first));
+    while (mask != 0) {
+      ret = simd_match_at(origin, len, i + __builtin_ctz(mask), str,
+                          pattern, case_insensitive);
+      if (ret >= 0) { return ret; }
+      mask &= mask - 1;
+    }
+  }
+  // Less than a vector left
+  return wait_for_string_scalar(origin, len, i, str, case_insensitive);
+}
+#endif  /* M2X_SCAN_SIMD */
+
+int M2XNanodeClient::waitForString(const char* origin, int len, const char* str) {
+  if (str[0] == '\0') { return 0; }
+#ifdef M2X_SCAN_SIMD
+  return wait_for_string_simd(origin, len, str, _case_insensitive);
+#else
+  return wait_for_string_scalar(origin, len, 0, str, _case_insensitive);
+#endif
+}
+
 int M2XNanodeClient::readStatusCode(const char* origin, int len) {
   int responseCode = 0, i = 0;
   int ret = waitForString(origin, len, "HTTP/*.* ");
@@ -664,17 +947,132 @@ int M2XNanodeClient::skipHttpHeader(const char* origin, int len) {
   return waitForString(origin, len, "\n\r\n");
 }
 
-int M2XNanodeClient::loop() {
+void M2XNanodeClient::setRecorder(M2XTrafficRecorder* recorder) {
+  s_recorder = recorder;
+}
+
+void M2XNanodeClient::setEndpoints(M2XEndpoint* endpoints, int count) {
+  _endpoints = endpoints;
+  // Tried endpoints are tracked in a 16-bit mask
+  _endpoint_count = MIN(count, 16);
+}
+
+int M2XNanodeClient::pickEndpoint(uint16_t tried) {
+  int i, best = -1, fallback = -1;
+  unsigned long now = millis(), score, best_score = 0;
+  M2XEndpoint* endpoint;
+
+  for (i = 0; i < _endpoint_count; i++) {
+    if (tried & ((uint16_t) 1 << i)) { continue; }
+    endpoint = &_endpoints[i];
+    if ((endpoint->failures > 0) &&
+        (now - endpoint->failed_at_millis <
+         kEndpointRetryMillis * MIN(endpoint->failures, 8))) {
+      // Still cooling down, only used when nothing else is left, the one
+      // failing longest ago first
+      if ((fallback < 0) ||
+          (now - endpoint->failed_at_millis >
+           now - _endpoints[fallback].failed_at_millis)) {
+        fallback = i;
+      }
+      continue;
+    }
+    // Unknown latency scores 0, so new endpoints get measured first
+    score = endpoint->latency_millis +
+        endpoint->latency_millis * endpoint->failure_rate / 64;
+    if ((best < 0) || (score < best_score)) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return (best >= 0) ? best : fallback;
+}
+
+int M2XNanodeClient::sendRequest(tcp_result_callback result_cb,
+                                 tcp_datafill_callback datafill_cb) {
+  int attempt, index, status = E_TIMEOUT;
+  uint16_t tried = 0;
+  unsigned long timeout = (unsigned long) _timeout_seconds * 1000;
+  unsigned long attempt_timeout, latency, start = millis();
+  M2XEndpoint* endpoint;
+
+  if (_endpoint_count == 0) {
+    return sendRequestTo(_addr, _port, timeout, result_cb, datafill_cb);
+  }
+
+  for (attempt = 0; attempt < _endpoint_count; attempt++) {
+    index = pickEndpoint(tried);
+    tried |= (uint16_t) 1 << index;
+    endpoint = &_endpoints[index];
+
+    attempt_timeout = timeout;
+    if ((attempt < _endpoint_count - 1) && endpoint->latency_known) {
+      // Give up early when there is still another endpoint to try
+      attempt_timeout = endpoint->latency_millis * 4;
+      if (attempt_timeout < kMinEndpointTimeoutMillis) {
+        attempt_timeout = kMinEndpointTimeoutMillis;
+      }
+      if (attempt_timeout > timeout) { attempt_timeout = timeout; }
+    }
+
+    status = sendRequestTo(endpoint->addr, endpoint->port, attempt_timeout,
+                           result_cb, datafill_cb);
+    // The endpoint is rated on its own attempt, the caller sees the time
+    // spent on all of them
+    latency = _last_latency_millis;
+    _last_latency_millis = millis() - start;
+    // Positive values below 100 are ethercard connection errors (such as
+    // a reset) passed through by the response callbacks
+    if ((status == E_TIMEOUT) || (status == E_DISCONNECTED) ||
+        ((status > 0) && (status < 100)) || (status >= 500)) {
+      if (endpoint->failures < 255) { endpoint->failures++; }
+      endpoint->failed_at_millis = millis();
+      endpoint->failure_rate += (255 - endpoint->failure_rate) / 8;
+      continue;
+    }
+
+    endpoint->failures = 0;
+    endpoint->failure_rate -= endpoint->failure_rate / 8;
+    // Exponential moving average with a weight of 1/8
+    endpoint->latency_millis = endpoint->latency_known ?
+        (endpoint->latency_millis * 7 + latency) / 8 : latency;
+    endpoint->latency_known = 1;
+    return status;
+  }
+  return status;
+}
+
+int M2XNanodeClient::sendRequestTo(IPAddress* addr, int port,
+                                   unsigned long timeout_millis,
+                                   tcp_result_callback result_cb,
+                                   tcp_datafill_callback datafill_cb) {
   int i;
-  for (i = 0; i < _timeout_seconds * 10; i++) {
+  ether.packetLoop(ether.packetReceive());
+  for (i = 0; i < 4; i++) {
+    ether.hisip[i] = (*addr)[i];
+  }
+  s_response_code = 0;
+  // Stays 0 unless the request is actually written
+  s_request_length = 0;
+  s_fd = ether.clientTcpReq(result_cb, datafill_cb, port);
+  return loop(timeout_millis);
+}
+
+int M2XNanodeClient::loop(unsigned long timeout_millis) {
+  // Unsigned subtraction keeps the timeout correct when millis() overflows
+  unsigned long start = millis();
+  while (millis() - start < timeout_millis) {
     ether.packetLoop(ether.packetReceive());
     if (s_response_code != 0) {
-      // Request already processed
+      // Request already processed, the connection is closed by the
+      // response callback so the next request can start right away
+      _last_latency_millis = millis() - start;
       return s_response_code;
     }
-    // Here we just use an approximation, since millis() has
-    // overflow problem
-    delay(100);
+  }
+  _last_latency_millis = millis() - start;
+  if (s_recorder) {
+    s_recorder->record(kSegmentTimeout, NULL, 0);
   }
   return E_TIMEOUT;
 }
@@ -9,6 +9,12 @@
 
 #define USER_AGENT F("User-Agent: M2X Nanode Client/2.0.2")
 
+// Maximum number of streams buffered between +beginUpdate+ and
+// +commitUpdate+, see +beginUpdate+ for details.
+#ifndef M2X_COMBINE_MAX_STREAMS
+#define M2X_COMBINE_MAX_STREAMS 4
+#endif
+
 #define HEX(t_) ((char) (((t_) > 9) ? ((t_) - 10 + 'A') : ((t_) + '0')))
 #define MAX_DOUBLE_DIGITS 7
 
@@ -18,6 +24,7 @@ const int E_INVALID = -2;
 const int E_TIMEOUT = -3;
 const int E_NOMATCH = -4;
 const int E_BUFFER_TOO_SMALL = -5;
+const int E_SUPPRESSED = -6;
 
 typedef void (*put_data_fill_callback)(Print* print);
 typedef void (*post_data_fill_callback)(Print* print, int index);
@@ -46,6 +53,54 @@ typedef void (*delete_values_timestamp_fill_callback)(Print* print, int type);
 
 const int kDefaultM2XPort PROGMEM = 80;
 
+// One M2X endpoint (the API server, or a local relay forwarding to it)
+// for +setEndpoints+. Only +addr+ and +port+ need to be set, the other
+// fields are health statistics kept by the client, and must start at 0:
+//
+// M2XEndpoint endpoints[] = { { &primary, 80 }, { &relay, 8080 } };
+struct M2XEndpoint {
+  IPAddress* addr;
+  int port;
+  // Smoothed request latency, only meaningful once +latency_known+ is set
+  unsigned long latency_millis;
+  // Smoothed failure rate, from 0 (never fails) to 255 (always fails)
+  uint8_t failure_rate;
+  // Number of failures in a row
+  uint8_t failures;
+  // When the endpoint last failed, it is skipped for a while after that
+  unsigned long failed_at_millis;
+  // Set by the first successful request, a fast endpoint can measure 0
+  uint8_t latency_known;
+};
+
+class M2XTrafficRecorder;
+
+// Internal callback types of the ethercard TCP client
+typedef uint8_t (*tcp_result_callback)(uint8_t fd, uint8_t statuscode,
+                                       uint16_t datapos, uint16_t len_of_data);
+typedef uint16_t (*tcp_datafill_callback)(uint8_t fd);
+
+// Macros building fixed request layouts for +postFixedDeviceUpdate+ out
+// of string literals, so the whole skeleton is assembled by the compiler.
+// Device ids and stream names used here are not encoded, so they must
+// only contain letters, digits, '-', '_', '.' and '~'.
+//
+// const char kRequest[] PROGMEM = M2X_FIXED_UPDATE_REQUEST("<Device ID>");
+// const char kLayout[] PROGMEM = M2X_FIXED_LAYOUT(
+//     M2X_FIXED_STREAM("temperature") M2X_FIXED_NEXT
+//     M2X_FIXED_STREAM("humidity"));
+#define M2X_FIXED_UPDATE_REQUEST(device_id) \
+  "POST /v2/devices/" device_id "/update HTTP/1.0"
+#define M2X_FIXED_STREAM(name) "\"" name "\":" M2X_FIXED_VALUE_SLOT
+#define M2X_FIXED_NEXT ","
+#define M2X_FIXED_LAYOUT(streams) "{\"values\":{" streams "}}"
+#define M2X_FIXED_LAYOUT_WITH_TIMESTAMP(streams) \
+  "{\"timestamp\":" M2X_FIXED_TIMESTAMP_SLOT ",\"values\":{" streams "}}"
+// Placeholders for the values filled in at runtime, kept as separate
+// literals so they never merge with the characters following them
+#define M2X_FIXED_VALUE_SLOT "\x01"
+#define M2X_FIXED_TIMESTAMP_SLOT "\x02"
+
 class M2XNanodeClient {
 public:
   M2XNanodeClient(const char* key,
@@ -54,10 +109,50 @@ public:
                   int case_insensitive = 1,
                   int port = kDefaultM2XPort);
 
+  // Spreads requests over a list of endpoints instead of the single
+  // address given in the constructor. Each request goes to the healthy
+  // endpoint with the lowest smoothed latency. When an endpoint times out,
+  // disconnects or answers with a 5xx status, the request is retried right
+  // away on the next endpoint, and the failing one is skipped for a while.
+  // Connection errors reported by ethercard (status codes below 100) count
+  // as failures too.
+  // Once latency is known, endpoints time out after 4 times their usual
+  // latency instead of the full +timeout_seconds+, except for the last
+  // endpoint tried.
+  // The array is owned by the caller and must outlive the client; keeping
+  // it in a global variable also keeps statistics across clients.
+  void setEndpoints(M2XEndpoint* endpoints, int count);
+
+  // Records every request, response packet and timeout into +recorder+,
+  // use NULL to stop recording. The recorder is shared by all clients.
+  void setRecorder(M2XTrafficRecorder* recorder);
+
   // Push data stream value using PUT request, returns the HTTP status code
   int updateStreamValue(const char* device_id, const char* stream_name,
                         put_data_fill_callback cb);
 
+  // Starts buffering +updateStreamValue+ calls. Until +commitUpdate+ is
+  // called, +updateStreamValue+ only records the stream and returns E_OK,
+  // and all buffered values are then sent as one +postDeviceUpdate+
+  // request. Callbacks are invoked when the request is sent, not when
+  // +updateStreamValue+ is called.
+  // If the buffer is full, or a value for another device is buffered,
+  // the values buffered so far are sent right away.
+  // +device_id+ and +stream_name+ are kept as pointers, so they must stay
+  // valid till the values are sent. The buffer is shared by all clients:
+  // while one client has an update open, +beginUpdate+ and +commitUpdate+
+  // of other clients do nothing and their values are sent right away.
+  // Scopes of the same client nest: an inner +beginUpdate+ first sends
+  // what is buffered, and only the outermost +commitUpdate+ stops
+  // buffering.
+  void beginUpdate();
+
+  // Sends all values buffered since +beginUpdate+ and stops buffering.
+  // Returns the HTTP status code shared by all buffered values. If more
+  // than one request was needed, the first failing status is returned.
+  // E_OK is returned if nothing was buffered.
+  int commitUpdate();
+
   // Push multiple data stream values using POST request, returns the
   // HTTP status code
   // NOTE: timestamp is required in this function
@@ -73,6 +168,25 @@ public:
                         post_multiple_data_fill_callback timestamp_cb,
                         post_multiple_data_fill_callback data_cb);
 
+  // Same request as +postDeviceUpdate+, but for a device id and a stream
+  // set known at compile time. +request_line+ and +layout+ are PROGMEM
+  // strings built with the M2X_FIXED_* macros above. The constant part of
+  // the body is assembled by the compiler, and its slots are counted once
+  // at runtime the first time +layout+ is sent (and again whenever another
+  // layout was sent in between). Per request, only the values are measured
+  // and printed: +data_cb+ is called with 0 as value index and the
+  // position of the stream in +layout+ as stream index.
+  // +timestamp_cb+ must be given if and only if +layout+ was built with
+  // M2X_FIXED_LAYOUT_WITH_TIMESTAMP, use NULL otherwise. E_INVALID is
+  // returned without sending anything when they do not match.
+  template <size_t L>
+  int postFixedDeviceUpdate(const char* request_line, const char (&layout)[L],
+                            put_data_fill_callback timestamp_cb,
+                            post_multiple_data_fill_callback data_cb) {
+    // Excludes the trailing NUL
+    return postFixedLayout(request_line, layout, L - 1, timestamp_cb, data_cb);
+  }
+
   // Push multiple data values to multiple streams of one device
   // returns HTTP status code
   // NOTE: timestamp is actually optional here, use NULL if you don't
@@ -151,10 +265,26 @@ public:
   // enough.
   int getTimestamp(char* buffer, int* bufferLength, int type = 2);
 
+  // Returns the time in milliseconds the last request took, from sending
+  // the request till the status code was known (or till timeout). With
+  // +setEndpoints+, this includes all failed attempts before the last one.
+  unsigned long lastLatencyMillis();
+
+  // Returns the size in bytes of the last request, headers included, or 0
+  // if it was never written, e.g. because the connection failed.
+  int lastRequestLength();
+
   // WARNING: The functions below this line are not considered APIs, they
   // are made public only to ensure callback functions can call them. Make
   // sure you know what you are doing before calling them.
 
+  // Sends a fixed layout request, see +postFixedDeviceUpdate+.
+  // +layout_length+ is the length of +layout+ including the slots.
+  int postFixedLayout(const char* request_line, const char* layout,
+                      int layout_length,
+                      put_data_fill_callback timestamp_cb,
+                      post_multiple_data_fill_callback data_cb);
+
   // Writes the HTTP header part for updating a stream value
   void writeHttpHeader(Print* print, int content_length);
 
@@ -175,16 +305,39 @@ private:
   int _case_insensitive;
   IPAddress* _addr;
   int _port;
+  unsigned long _last_latency_millis;
+  M2XEndpoint* _endpoints;
+  int _endpoint_count;
 
   // Waits for a certain string pattern in the HTTP header, and returns
   // once the pattern is found. In the pattern, you can use '*' to denote
-  // any character
+  // any character. Builds for hosts with SSE2 scan 16 or 32 bytes at a
+  // time, see the top of M2XNanodeClient.cpp.
   int waitForString(const char* origin, int len, const char* str);
 
+  // Sends values buffered by +updateStreamValue+ since +beginUpdate+
+  void flushCombined();
+
+  // Sends the request prepared in the internal state, picking an
+  // endpoint and failing over if needed.
+  int sendRequest(tcp_result_callback result_cb,
+                  tcp_datafill_callback datafill_cb);
+
+  // Sends the request to a single address and waits for the response
+  int sendRequestTo(IPAddress* addr, int port, unsigned long timeout_millis,
+                    tcp_result_callback result_cb,
+                    tcp_datafill_callback datafill_cb);
+
+  // Returns the index of the endpoint to try next, skipping endpoints
+  // whose bit is set in +tried+
+  int pickEndpoint(uint16_t tried);
+
   // Run network loop till one of the following conditions is met:
   // 1. A response code is obtained;
   // 2. The request has time out.
-  int loop();
+  // The network is polled continuously, so the request completes as
+  // soon as the response callback got the status code.
+  int loop(unsigned long timeout_millis);
 };
 
 #endif  /* M2XNanodeClient_h */
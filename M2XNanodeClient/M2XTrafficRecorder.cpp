@@ -0,0 +1,115 @@
+#include "M2XTrafficRecorder.h"
+
+// Each segment is stored as: type (1 byte), millis (4 bytes, little
+// endian), full length (2 bytes), stored length (1 byte), stored bytes
+static const int kSegmentHeaderSize = 8;
+
+M2XTrafficRecorder::M2XTrafficRecorder(uint8_t* buffer, int size,
+                                       int max_segment_bytes)
+    : _buffer(buffer),
+      _size(size),
+      _max_segment_bytes(MIN(max_segment_bytes, 255)),
+      _head(0),
+      _tail(0),
+      _used(0),
+      _count(0) {
+}
+
+uint8_t M2XTrafficRecorder::peek(int offset) {
+  return _buffer[(_tail + offset) % _size];
+}
+
+void M2XTrafficRecorder::push(uint8_t b) {
+  _buffer[_head] = b;
+  _head = (_head + 1) % _size;
+  _used++;
+}
+
+void M2XTrafficRecorder::dropOldest() {
+  int length = kSegmentHeaderSize + peek(7);
+  _tail = (_tail + length) % _size;
+  _used -= length;
+  _count--;
+}
+
+void M2XTrafficRecorder::record(uint8_t type, const uint8_t* data, int length) {
+  int i, stored = MIN(length, (int) _max_segment_bytes);
+  unsigned long now = millis();
+
+  if (type == kSegmentRequest) {
+    // The request line is always kept whole, real device ids alone take
+    // 32 bytes of it
+    for (i = 0; (i + 1 < MIN(length, 255)) &&
+                ((data[i] != '\r') || (data[i + 1] != '\n')); i++) {}
+    if (i + 2 > stored) { stored = MIN(i + 2, MIN(length, 255)); }
+  }
+
+  if (stored > _size - kSegmentHeaderSize) {
+    stored = _size - kSegmentHeaderSize;
+  }
+  if (stored < 0) { return; }
+  while (_used + kSegmentHeaderSize + stored > _size) {
+    dropOldest();
+  }
+
+  push(type);
+  for (i = 0; i < 4; i++) {
+    push((now >> (i * 8)) & 0xFF);
+  }
+  push(length & 0xFF);
+  push((length >> 8) & 0xFF);
+  push(stored);
+  for (i = 0; i < stored; i++) {
+    push(data[i]);
+  }
+  _count++;
+}
+
+void M2XTrafficRecorder::dump(Print* print) {
+  int offset = 0, n, i, stored;
+  unsigned long timestamp;
+  uint8_t type, b;
+
+  for (n = 0; n < _count; n++) {
+    type = peek(offset);
+    timestamp = 0;
+    for (i = 3; i >= 0; i--) {
+      timestamp = (timestamp << 8) | peek(offset + 1 + i);
+    }
+    stored = peek(offset + 7);
+
+    print->print(F("M2X "));
+    if (type == kSegmentRequest) {
+      print->print('>');
+    } else if (type == kSegmentResponse) {
+      print->print('<');
+    } else if (type == kSegmentError) {
+      print->print('x');
+    } else {
+      print->print('!');
+    }
+    print->print(' ');
+    print->print(timestamp);
+    print->print(' ');
+    print->print(peek(offset + 5) | (peek(offset + 6) << 8));
+    print->print(' ');
+    for (i = 0; i < stored; i++) {
+      b = peek(offset + kSegmentHeaderSize + i);
+      print->print(HEX(b / 16));
+      print->print(HEX(b % 16));
+    }
+    print->println();
+    offset += kSegmentHeaderSize + stored;
+  }
+}
+
+void M2XTrafficRecorder::clear() {
+  _head = 0;
+  _tail = 0;
+  _used = 0;
+  _count = 0;
+}
+
+int M2XTrafficRecorder::count() {
+  return _count;
+}
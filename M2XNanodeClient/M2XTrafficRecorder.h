@@ -0,0 +1,58 @@
+#ifndef M2XTrafficRecorder_h
+#define M2XTrafficRecorder_h
+
+#include "M2XNanodeClient.h"
+
+// Values of segment type:
+// 1 - Request sent to the server
+// 2 - Response packet received from the server
+// 3 - Request timed out
+// 4 - Connection error reported by ethercard, the data is the nonzero
+//     status code passed to the result callback (3 for a reset)
+const uint8_t kSegmentRequest PROGMEM = 1;
+const uint8_t kSegmentResponse PROGMEM = 2;
+const uint8_t kSegmentTimeout PROGMEM = 3;
+const uint8_t kSegmentError PROGMEM = 4;
+
+// Records timestamped request and response segments into a ring buffer
+// provided by the caller. Once the buffer is full, the oldest segments
+// are dropped. Attach it to a client with +M2XNanodeClient::setRecorder+.
+class M2XTrafficRecorder {
+public:
+  // Only the first +max_segment_bytes+ bytes (at most 255) of each
+  // segment are kept, which is enough for the status line. Requests keep
+  // at least their request line, even when it is longer.
+  M2XTrafficRecorder(uint8_t* buffer, int size, int max_segment_bytes = 64);
+
+  void record(uint8_t type, const uint8_t* data, int length);
+
+  // Prints all recorded segments, oldest first, one per line:
+  //
+  // M2X <type> <millis> <length> <hex bytes>
+  //
+  // where +type+ is '>' for requests, '<' for responses, 'x' for
+  // connection errors and '!' for timeouts, and +length+ is the full
+  // segment length before truncation.
+  // This is the input format of the m2x_replay host tool.
+  void dump(Print* print);
+
+  void clear();
+
+  // Number of segments currently recorded
+  int count();
+
+private:
+  uint8_t* _buffer;
+  int _size;
+  uint8_t _max_segment_bytes;
+  int _head;
+  int _tail;
+  int _used;
+  int _count;
+
+  uint8_t peek(int offset);
+  void push(uint8_t b);
+  void dropOldest();
+};
+
+#endif  /* M2XTrafficRecorder_h */
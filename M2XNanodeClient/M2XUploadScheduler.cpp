@@ -0,0 +1,234 @@
+#include "M2XUploadScheduler.h"
+
+#include <string.h>
+
+// Values of operation type
+static const uint8_t kOperationNone = 0;
+static const uint8_t kOperationStreamValue = 1;
+static const uint8_t kOperationLocation = 2;
+static const uint8_t kOperationCommandProcessed = 3;
+static const uint8_t kOperationCommandRejected = 4;
+static const uint8_t kOperationCombined = 5;
+
+static int same_string(const char* a, const char* b) {
+  if (a == b) { return 1; }
+  if ((a == NULL) || (b == NULL)) { return 0; }
+  return strcmp(a, b) == 0;
+}
+
+M2XUploadScheduler::M2XUploadScheduler(M2XNanodeClient* client,
+                                       unsigned long window_millis,
+                                       upload_status_callback status_cb)
+    : _client(client),
+      _window_millis(window_millis),
+      _window_start(millis()),
+      _status_cb(status_cb),
+      _count(0),
+      _flushing(0) {
+}
+
+int M2XUploadScheduler::updateStreamValue(const char* device_id,
+                                          const char* stream_name,
+                                          put_data_fill_callback cb,
+                                          int priority, int tag) {
+  Operation op;
+  op.type = kOperationStreamValue;
+  op.priority = priority;
+  op.device_id = device_id;
+  op.name = stream_name;
+  op.cb.put_cb = cb;
+  op.tag = tag;
+  return enqueue(op);
+}
+
+int M2XUploadScheduler::updateLocation(const char* device_id, int has_name,
+                                       int has_elevation,
+                                       update_location_data_fill_callback cb,
+                                       int tag) {
+  Operation op;
+  op.type = kOperationLocation;
+  op.priority = kUploadPriorityLocation;
+  op.has_name = has_name;
+  op.has_elevation = has_elevation;
+  op.device_id = device_id;
+  op.name = NULL;
+  op.cb.location_cb = cb;
+  op.tag = tag;
+  return enqueue(op);
+}
+
+int M2XUploadScheduler::markCommandProcessed(const char* device_id,
+                                             const char* command_id,
+                                             put_data_fill_callback body_cb,
+                                             int priority, int tag) {
+  Operation op;
+  op.type = kOperationCommandProcessed;
+  op.priority = priority;
+  op.device_id = device_id;
+  op.name = command_id;
+  op.cb.put_cb = body_cb;
+  op.tag = tag;
+  return enqueue(op);
+}
+
+int M2XUploadScheduler::markCommandRejected(const char* device_id,
+                                            const char* command_id,
+                                            put_data_fill_callback body_cb,
+                                            int priority, int tag) {
+  Operation op;
+  op.type = kOperationCommandRejected;
+  op.priority = priority;
+  op.device_id = device_id;
+  op.name = command_id;
+  op.cb.put_cb = body_cb;
+  op.tag = tag;
+  return enqueue(op);
+}
+
+int M2XUploadScheduler::enqueue(const Operation& op) {
+  int i, status;
+
+  if (op.priority > kUploadPriorityLocation) {
+    return E_INVALID;
+  }
+  if (op.priority == kUploadPriorityAlarm) {
+    // The NIC is woken up anyway, so everything queued rides along
+    status = send(op);
+    if (!_flushing) { flush(); }
+    return status;
+  }
+
+  for (i = 0; i < _count; i++) {
+    Operation* queued = &_queue[i];
+    if ((queued->type == op.type) &&
+        same_string(queued->device_id, op.device_id) &&
+        ((op.type == kOperationLocation) ||
+         (same_string(queued->name, op.name) &&
+          (queued->cb.put_cb == op.cb.put_cb)))) {
+      // Values are only read when the window opens, so a second request
+      // for the same target would carry the same data. The replaced
+      // operation still gets its one status report.
+      if (_status_cb) { _status_cb(queued->tag, E_SUPPRESSED); }
+      *queued = op;
+      return E_OK;
+    }
+  }
+
+  if (_count >= M2X_SCHEDULER_QUEUE_SIZE) {
+    if (_flushing) {
+      // Queued from a status callback, slots are only freed once the
+      // running flush is done
+      return E_BUFFER_TOO_SMALL;
+    }
+    // Queue is full, open the window early instead of dropping data
+    flush();
+  }
+  _queue[_count++] = op;
+  return E_OK;
+}
+
+int M2XUploadScheduler::send(const Operation& op) {
+  int status;
+  switch (op.type) {
+    case kOperationStreamValue:
+      status = _client->updateStreamValue(op.device_id, op.name, op.cb.put_cb);
+      break;
+    case kOperationLocation:
+      status = _client->updateLocation(op.device_id, op.has_name,
+                                       op.has_elevation, op.cb.location_cb);
+      break;
+    case kOperationCommandProcessed:
+      status = _client->markCommandProcessed(op.device_id, op.name,
+                                             op.cb.put_cb);
+      break;
+    case kOperationCommandRejected:
+      status = _client->markCommandRejected(op.device_id, op.name,
+                                            op.cb.put_cb);
+      break;
+    default:
+      status = E_INVALID;
+      break;
+  }
+  if (_status_cb) {
+    _status_cb(op.tag, status);
+  }
+  return status;
+}
+
+int M2XUploadScheduler::run() {
+  if ((_count > 0) && (millisUntilWindow() == 0)) {
+    return flush();
+  }
+  return 0;
+}
+
+int M2XUploadScheduler::flush() {
+  int i, j, n, priority, status, sent = 0;
+  _flushing = 1;
+  // Operations are sent in priority order, and in queueing order
+  // within the same priority
+  for (priority = kUploadPriorityTelemetry;
+       priority <= kUploadPriorityLocation; priority++) {
+    for (i = 0; i < _count; i++) {
+      if ((_queue[i].type == kOperationNone) ||
+          (_queue[i].priority != priority)) {
+        continue;
+      }
+      if (_queue[i].type != kOperationStreamValue) {
+        send(_queue[i]);
+        _queue[i].type = kOperationNone;
+        sent++;
+        continue;
+      }
+      // Stream values of the same device are combined into one request
+      _client->beginUpdate();
+      for (j = i, n = 0; (j < _count) && (n < M2X_COMBINE_MAX_STREAMS); j++) {
+        if ((_queue[j].type == kOperationStreamValue) &&
+            (_queue[j].priority == priority) &&
+            same_string(_queue[j].device_id, _queue[i].device_id)) {
+          _client->updateStreamValue(_queue[j].device_id, _queue[j].name,
+                                     _queue[j].cb.put_cb);
+          // Marked as pending status report
+          _queue[j].type = kOperationCombined;
+          n++;
+        }
+      }
+      status = _client->commitUpdate();
+      sent++;
+      for (j = i; j < _count; j++) {
+        if (_queue[j].type == kOperationCombined) {
+          if (_status_cb) { _status_cb(_queue[j].tag, status); }
+          _queue[j].type = kOperationNone;
+        }
+      }
+    }
+  }
+  _flushing = 0;
+  // Status callbacks can queue operations of a priority already passed,
+  // those wait for the next window
+  for (i = 0, j = 0; i < _count; i++) {
+    if (_queue[i].type != kOperationNone) {
+      _queue[j++] = _queue[i];
+    }
+  }
+  _count = j;
+  _window_start = millis();
+  return sent;
+}
+
+int M2XUploadScheduler::pending() {
+  return _count;
+}
+
+unsigned long M2XUploadScheduler::millisUntilWindow() {
+  // Unsigned subtraction keeps working when millis() overflows
+  unsigned long elapsed = millis() - _window_start;
+  if (elapsed >= _window_millis) {
+    return 0;
+  }
+  return _window_millis - elapsed;
+}
+
+void M2XUploadScheduler::setWindow(unsigned long window_millis) {
+  _window_millis = window_millis;
+}
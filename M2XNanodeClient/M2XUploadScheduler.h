@@ -0,0 +1,112 @@
+#ifndef M2XUploadScheduler_h
+#define M2XUploadScheduler_h
+
+#include "M2XNanodeClient.h"
+
+// Maximum number of operations that can wait for the next network
+// window. Each slot costs around 12 bytes of RAM.
+#ifndef M2X_SCHEDULER_QUEUE_SIZE
+#define M2X_SCHEDULER_QUEUE_SIZE 8
+#endif
+
+// Values of upload priority:
+// 0 - Alarm, sent immediately and opens a window right away
+// 1 - Telemetry, batched till the next window
+// 2 - Location, batched and sent last in a window
+const int kUploadPriorityAlarm PROGMEM = 0;
+const int kUploadPriorityTelemetry PROGMEM = 1;
+const int kUploadPriorityLocation PROGMEM = 2;
+
+// Called once for each queued operation after it is sent, +tag+ is
+// the value passed in when the operation was queued, +status+ is the
+// HTTP status code or the error code of the request. When a queued
+// operation is replaced by a newer one for the same target, it is
+// reported right away with E_SUPPRESSED, and the newer one carries the
+// status of the request.
+typedef void (*upload_status_callback)(int tag, int status);
+
+class M2XUploadScheduler {
+public:
+  M2XUploadScheduler(M2XNanodeClient* client,
+                     unsigned long window_millis = 60000,
+                     upload_status_callback status_cb = NULL);
+
+  // Queues a stream value update. Alarm priority values are sent right
+  // away together with everything already queued, and the HTTP status
+  // code of the alarm request is returned. Otherwise E_OK is returned
+  // once the value is queued.
+  // Values are fetched from the callback when the window opens, so
+  // queueing the same stream with the same callback twice only results
+  // in one request.
+  int updateStreamValue(const char* device_id, const char* stream_name,
+                        put_data_fill_callback cb,
+                        int priority = kUploadPriorityTelemetry,
+                        int tag = 0);
+
+  // Queues a location update with location priority. A newer location
+  // update for the same device replaces the queued one.
+  int updateLocation(const char* device_id, int has_name, int has_elevation,
+                     update_location_data_fill_callback cb, int tag = 0);
+
+  // Queues command acknowledgements, see +updateStreamValue+ for the
+  // meaning of +priority+ and the returned value.
+  int markCommandProcessed(const char* device_id, const char* command_id,
+                           put_data_fill_callback body_cb,
+                           int priority = kUploadPriorityTelemetry,
+                           int tag = 0);
+  int markCommandRejected(const char* device_id, const char* command_id,
+                          put_data_fill_callback body_cb,
+                          int priority = kUploadPriorityTelemetry,
+                          int tag = 0);
+
+  // Call this in the sketch loop, queued operations are flushed when
+  // the current window is due. Stream values of the same device are
+  // combined into one request, see +M2XNanodeClient::beginUpdate+.
+  // Returns the number of requests sent.
+  int run();
+
+  // Sends all queued operations now and starts a new window. Returns
+  // the number of requests sent. Operations queued from the status
+  // callback are sent in the same window if their priority has not been
+  // flushed yet, and in the next one otherwise. While flushing, queueing
+  // into a full queue returns E_BUFFER_TOO_SMALL.
+  int flush();
+
+  // Number of operations waiting for the next window
+  int pending();
+
+  // Milliseconds till the next window opens, 0 if it is already due.
+  // Sketches running on battery can use this to power down the NIC
+  // between windows.
+  unsigned long millisUntilWindow();
+
+  void setWindow(unsigned long window_millis);
+
+private:
+  struct Operation {
+    uint8_t type;
+    uint8_t priority;
+    uint8_t has_name;
+    uint8_t has_elevation;
+    const char* device_id;
+    const char* name;
+    union {
+      put_data_fill_callback put_cb;
+      update_location_data_fill_callback location_cb;
+    } cb;
+    int tag;
+  };
+
+  M2XNanodeClient* _client;
+  unsigned long _window_millis;
+  unsigned long _window_start;
+  upload_status_callback _status_cb;
+  Operation _queue[M2X_SCHEDULER_QUEUE_SIZE];
+  int _count;
+  uint8_t _flushing;
+
+  int enqueue(const Operation& op);
+  int send(const Operation& op);
+};
+
+#endif  /* M2XUploadScheduler_h */
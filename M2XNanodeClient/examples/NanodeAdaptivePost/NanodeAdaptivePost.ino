@@ -0,0 +1,91 @@
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+#include "M2XBatchController.h"
+
+// Enter a MAC address for your controller below.
+// Newer Ethernet shields have a MAC address printed on a sticker on the shield
+byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
+byte Ethernet::buffer[700];
+
+char deviceId[] = "<Device ID>"; // Device you want to post to
+char streamName[] = "<Stream Name>"; // Stream you want to post to
+char m2xKey[] = "<M2X Key>"; // Your M2X access key
+const char website[] PROGMEM = "api-m2x.att.com";
+
+static unsigned long timer;
+
+M2XBatchController batch(sizeof Ethernet::buffer);
+
+// Values waiting to be posted, one is sampled every second
+#define MAX_PENDING 32
+static int pending[MAX_PENDING];
+static int pendingCount = 0;
+static int sampleSeconds = 0;
+byte m2xIpAddress[4];
+
+void setup() {
+  Serial.begin(9600);
+
+  if ((!ether.begin(sizeof Ethernet::buffer, mac)) ||
+      (!ether.dhcpSetup())) {
+    Serial.println("Network error!");
+  }
+
+  ether.printIp(F("IP:\t"), ether.myip);
+  if (ether.dnsLookup(website)) {
+    ether.printIp(F("SRV:\t"), ether.hisip);
+    ether.copyIp(m2xIpAddress, ether.hisip);
+  }
+  Serial.println();
+
+  timer = millis();
+}
+
+void fill_timestamp_cb(Print* print, int index) {
+  int seconds = sampleSeconds - pendingCount + index;
+  print->print("\"2014-07-09T19:");
+  print->print(10 + (seconds / 60) % 50);
+  print->print(":");
+  print->print(10 + seconds % 50);
+  print->print(".624Z\"");
+}
+
+void fill_data_cb(Print* print, int index) {
+  print->print(pending[index]);
+}
+
+void loop() {
+  ether.packetLoop(ether.packetReceive());
+
+  if (millis() > timer) {
+    if (pendingCount < MAX_PENDING) {
+      pending[pendingCount++] = analogRead(0);
+    }
+    sampleSeconds++;
+    timer = millis() + 1000;
+  }
+
+  if (pendingCount >= batch.batchSize()) {
+    IPAddress addr(m2xIpAddress);
+    M2XNanodeClient m2xClient(m2xKey, &addr);
+
+    int samples = batch.batchSize();
+    int response = m2xClient.postStreamValues(deviceId, streamName, samples,
+                                              fill_timestamp_cb, fill_data_cb);
+    batch.record(&m2xClient, samples, response);
+    if ((response >= 200) && (response < 300)) {
+      for (int i = samples; i < pendingCount; i++) {
+        pending[i - samples] = pending[i];
+      }
+      pendingCount -= samples;
+    }
+
+    Serial.print("Code: ");
+    Serial.print(response);
+    Serial.print(" Next batch: ");
+    Serial.print(batch.batchSize());
+    Serial.print(" Samples/s x100: ");
+    Serial.println(batch.samplesPerSecondX100());
+  }
+}
@@ -0,0 +1,75 @@
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+
+// Enter a MAC address for your controller below.
+// Newer Ethernet shields have a MAC address printed on a sticker on the shield
+byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
+byte Ethernet::buffer[400];
+
+char deviceId[] = "<Device ID>"; // Device you want to post to
+char streamName[] = "<Stream Name>"; // Stream you want to post to
+char m2xKey[] = "<M2X Key>"; // Your M2X access key
+const char website[] PROGMEM = "api-m2x.att.com";
+
+static unsigned long timer;
+
+byte m2xIpAddress[4];
+// A relay on the local network forwarding requests to M2X
+byte relayIpAddress[4] = { 192, 168, 1, 10 };
+
+IPAddress primary;
+IPAddress relay(relayIpAddress);
+// Kept global, so endpoint statistics survive between requests
+M2XEndpoint endpoints[] = { { &primary, 80 }, { &relay, 8080 } };
+void setup() {
+  Serial.begin(9600);
+
+  if ((!ether.begin(sizeof Ethernet::buffer, mac)) ||
+      (!ether.dhcpSetup())) {
+    Serial.println("Network error!");
+  }
+
+  ether.printIp(F("IP:\t"), ether.myip);
+  if (ether.dnsLookup(website)) {
+    ether.printIp(F("SRV:\t"), ether.hisip);
+    ether.copyIp(m2xIpAddress, ether.hisip);
+  }
+  Serial.println();
+  primary = IPAddress(m2xIpAddress);
+
+  timer = millis();
+}
+
+static int val = 11;
+void fill_data_cb(Print* print) {
+  print->print(val);
+}
+
+void loop() {
+  ether.packetLoop(ether.packetReceive());
+
+  if (millis() > timer) {
+    M2XNanodeClient m2xClient(m2xKey, &primary);
+    m2xClient.setEndpoints(endpoints, 2);
+
+    Serial.println("Request!");
+    int response = m2xClient.updateStreamValue(deviceId, streamName, fill_data_cb);
+    Serial.print("Code: ");
+    Serial.println(response);
+    for (int i = 0; i < 2; i++) {
+      Serial.print("Endpoint ");
+      Serial.print(i);
+      Serial.print(": ");
+      Serial.print(endpoints[i].latency_millis);
+      Serial.print("ms, failures: ");
+      Serial.println(endpoints[i].failures);
+    }
+    Serial.print("Latency: ");
+    Serial.print(m2xClient.lastLatencyMillis());
+    Serial.println("ms");
+
+    val++;
+    timer = millis() + 5000;
+  }
+}
@@ -49,6 +49,9 @@ void loop() {
     int response = m2xClient.updateStreamValue(deviceId, streamName, fill_data_cb);
     Serial.print("Code: ");
     Serial.println(response);
+    Serial.print("Latency: ");
+    Serial.print(m2xClient.lastLatencyMillis());
+    Serial.println("ms");
 
     val++;
     timer = millis() + 5000;
@@ -0,0 +1,78 @@
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+#include "M2XUploadScheduler.h"
+
+// Enter a MAC address for your controller below.
+// Newer Ethernet shields have a MAC address printed on a sticker on the shield
+byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
+byte Ethernet::buffer[400];
+
+char deviceId[] = "<Device ID>"; // Device you want to post to
+char temperatureStream[] = "temperature"; // Telemetry stream
+char alarmStream[] = "alarm"; // Stream receiving alarm values
+char m2xKey[] = "<M2X Key>"; // Your M2X access key
+const char website[] PROGMEM = "api-m2x.att.com";
+
+static unsigned long timer;
+
+byte m2xIpAddress[4];
+IPAddress addr;
+M2XNanodeClient m2xClient(m2xKey, &addr);
+// Queued values are sent in one burst every 30 seconds
+M2XUploadScheduler scheduler(&m2xClient, 30000);
+
+void setup() {
+  Serial.begin(9600);
+
+  if ((!ether.begin(sizeof Ethernet::buffer, mac)) ||
+      (!ether.dhcpSetup())) {
+    Serial.println("Network error!");
+  }
+
+  ether.printIp(F("IP:\t"), ether.myip);
+  if (ether.dnsLookup(website)) {
+    ether.printIp(F("SRV:\t"), ether.hisip);
+    ether.copyIp(m2xIpAddress, ether.hisip);
+  }
+  Serial.println();
+  addr = IPAddress(m2xIpAddress);
+
+  timer = millis();
+}
+
+static int val = 11;
+void fill_data_cb(Print* print) {
+  print->print(val);
+}
+
+void fill_alarm_cb(Print* print) {
+  print->print(val);
+}
+
+void loop() {
+  ether.packetLoop(ether.packetReceive());
+
+  if (millis() > timer) {
+    // Telemetry only waits in the queue, nothing is sent here
+    scheduler.updateStreamValue(deviceId, temperatureStream, fill_data_cb);
+
+    if (val % 10 == 0) {
+      Serial.println("Alarm!");
+      int response = scheduler.updateStreamValue(deviceId, alarmStream,
+                                                 fill_alarm_cb,
+                                                 kUploadPriorityAlarm);
+      Serial.print("Code: ");
+      Serial.println(response);
+    }
+
+    val++;
+    timer = millis() + 5000;
+  }
+
+  int sent = scheduler.run();
+  if (sent > 0) {
+    Serial.print("Window flushed, requests: ");
+    Serial.println(sent);
+  }
+}
@@ -0,0 +1,73 @@
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+#include "M2XLocationTracker.h"
+
+// Enter a MAC address for your controller below.
+// Newer Ethernet shields have a MAC address printed on a sticker on the shield
+byte mac[] = { 0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED };
+byte Ethernet::buffer[400];
+
+char deviceId[] = "<Device ID>"; // Device you want to post to
+char m2xKey[] = "<M2X Key>"; // Your M2X access key
+const char website[] PROGMEM = "api-m2x.att.com";
+
+static unsigned long timer;
+byte m2xIpAddress[4];
+
+void setup() {
+  Serial.begin(9600);
+
+  if ((!ether.begin(sizeof Ethernet::buffer, mac)) ||
+      (!ether.dhcpSetup())) {
+    Serial.println("Network error!");
+  }
+
+  ether.printIp(F("IP:\t"), ether.myip);
+  if (ether.dnsLookup(website)) {
+    ether.printIp(F("SRV:\t"), ether.hisip);
+    ether.copyIp(m2xIpAddress, ether.hisip);
+  }
+  Serial.println();
+
+  timer = millis();
+}
+
+// Only report when moved 25 meters, turned 30 degrees, or every 10 minutes
+M2XLocationTracker tracker(25, 30, 600000);
+
+// Current fix in microdegrees, this would come from the GPS module
+static int32_t latitude = -37978842;
+static int32_t longitude = -57547877;
+static int heading = 90;
+
+void fill_data_cb(Print* print, int dataType) {
+  if (dataType == 1) {
+    // Latitude
+    M2XLocationTracker::printMicrodegrees(print, latitude);
+  } else if (dataType == 2) {
+    // Longitude
+    M2XLocationTracker::printMicrodegrees(print, longitude);
+  }
+}
+
+void loop() {
+  ether.packetLoop(ether.packetReceive());
+
+  if (millis() > timer) {
+    IPAddress addr(m2xIpAddress);
+    M2XNanodeClient m2xClient(m2xKey, &addr);
+
+    int response = tracker.updateLocation(&m2xClient, deviceId,
+                                          latitude, longitude, heading,
+                                          0, 0, fill_data_cb);
+    if (response != E_SUPPRESSED) {
+      Serial.print("Code: ");
+      Serial.println(response);
+    }
+
+    // Simulate a slowly moving device
+    latitude += 50;
+    timer = millis() + 5000;
+  }
+}
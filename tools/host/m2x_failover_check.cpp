@@ -0,0 +1,156 @@
+// Checks endpoint failover of the client library against local stand-in
+// servers: a refused endpoint, a delayed endpoint, a fast endpoint that
+// turns slow, and recovery of the refused endpoint once it comes back.
+//
+// Usage: m2x_failover_check
+//
+// Prints one line per step and exits with a nonzero status if any step
+// does not behave as expected.
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+#include "stub_server.h"
+
+byte Ethernet::buffer[1500];
+
+namespace {
+
+const int kTimeoutSeconds = 5;
+const int kDelayedMillis = 300;
+const int kSlowMillis = 3000;
+// Longer than any cooldown of a failing endpoint
+const unsigned long kAgeMillis = 10UL * 60 * 1000;
+
+// Endpoints, in the order given to the client
+enum { kRefused, kDelayed, kFast, kEndpointCount };
+
+int s_failures;
+
+void value_cb(Print* print) {
+  print->print(42);
+}
+
+// Starts a stand-in server in a child process, returns its pid. +port+ 0
+// picks a free port and stores it.
+pid_t start_server(int* port, int delay_ms) {
+  StubServerOptions options = { *port, 4, delay_ms, false };
+  int fd = stub_server_listen(&options);
+  if (fd < 0) {
+    perror("listen");
+    exit(1);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    stub_server_run(fd, options);
+    _exit(0);
+  }
+  close(fd);
+  *port = options.port;
+  return pid;
+}
+
+void stop_server(pid_t pid) {
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+// A port nothing listens on, so connections are refused
+int free_port() {
+  StubServerOptions options = { 0, 0, 0, false };
+  int fd = stub_server_listen(&options);
+  if (fd < 0) {
+    perror("listen");
+    exit(1);
+  }
+  close(fd);
+  return options.port;
+}
+
+void expect(bool ok, const char* what) {
+  printf("  %s  %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) { s_failures++; }
+}
+
+int send_value(M2XNanodeClient* client, const char* step, M2XEndpoint* endpoints) {
+  int status = client->updateStreamValue("failover-device", "stream", value_cb);
+  printf("%s: status %d, %lu ms;", step, status, client->lastLatencyMillis());
+  for (int i = 0; i < kEndpointCount; i++) {
+    printf(" [%d] %s%lu ms %d failures", i,
+           endpoints[i].latency_known ? "" : "~", endpoints[i].latency_millis,
+           endpoints[i].failures);
+  }
+  printf("\n");
+  return status;
+}
+
+}  // namespace
+
+int main() {
+  IPAddress addr(127, 0, 0, 1);
+  int ports[kEndpointCount];
+  pid_t pids[kEndpointCount] = { 0, 0, 0 };
+  M2XEndpoint endpoints[kEndpointCount];
+  int status;
+
+  ether.begin(sizeof Ethernet::buffer, NULL);
+  ports[kRefused] = free_port();
+  ports[kDelayed] = 0;
+  pids[kDelayed] = start_server(&ports[kDelayed], kDelayedMillis);
+  ports[kFast] = 0;
+  pids[kFast] = start_server(&ports[kFast], 0);
+
+  memset(endpoints, 0, sizeof(endpoints));
+  for (int i = 0; i < kEndpointCount; i++) {
+    endpoints[i].addr = &addr;
+    endpoints[i].port = ports[i];
+  }
+  M2XNanodeClient client("failover-key", &addr, kTimeoutSeconds);
+  client.setEndpoints(endpoints, kEndpointCount);
+
+  // Nothing is measured yet, so the endpoints are tried in order
+  status = send_value(&client, "refused endpoint", endpoints);
+  expect(status == 202, "request fails over to the next endpoint");
+  expect(endpoints[kRefused].failures == 1, "refused endpoint counts a failure");
+  expect(client.lastLatencyMillis() >= (unsigned long) kDelayedMillis,
+         "latency covers every attempt");
+
+  status = send_value(&client, "unmeasured endpoint", endpoints);
+  expect((status == 202) && endpoints[kFast].latency_known,
+         "refused endpoint is skipped, the unmeasured one is measured");
+
+  status = send_value(&client, "fastest endpoint", endpoints);
+  expect((status == 202) && (client.lastLatencyMillis() < kDelayedMillis),
+         "fastest endpoint is preferred");
+
+  // The fast endpoint turns slow: the shortened timeout must apply even
+  // though its measured latency may be 0 ms
+  stop_server(pids[kFast]);
+  pids[kFast] = start_server(&ports[kFast], kSlowMillis);
+  status = send_value(&client, "slow endpoint", endpoints);
+  expect(status == 202, "request fails over from the slow endpoint");
+  expect(endpoints[kFast].failures == 1, "slow endpoint counts a failure");
+  expect(client.lastLatencyMillis() < (unsigned long) kSlowMillis,
+         "slow endpoint is given up before it answers");
+
+  // The refused endpoint comes back. Its cooldown is aged instead of
+  // waiting for it in real time.
+  pids[kRefused] = start_server(&ports[kRefused], 0);
+  endpoints[kRefused].failed_at_millis -= kAgeMillis;
+  status = send_value(&client, "recovered endpoint", endpoints);
+  expect((status == 202) && (endpoints[kRefused].failures == 0) &&
+         endpoints[kRefused].latency_known,
+         "recovered endpoint is used again");
+
+  for (int i = 0; i < kEndpointCount; i++) {
+    if (pids[i] > 0) { stop_server(pids[i]); }
+  }
+  printf("\n%d failed checks\n", s_failures);
+  return (s_failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,470 @@
+// Load generator driving many virtual devices through the real request
+// builders of the client library against a stand-in M2X server.
+//
+// Every combination of the given concurrency and batch size values is run
+// for a fixed duration, and one line of results is printed per run.
+// Concurrency is the number of worker processes sending requests at the
+// same time: the client keeps its request state in file statics, so each
+// worker is a separate process serving its share of the virtual devices.
+//
+// Usage: m2x_loadgen [options]
+//   -p port         stand-in server port, by default one is started
+//   -d delay_ms     response delay of the started server
+//   -n devices      number of virtual devices (default 1000)
+//   -s streams      streams per device (default 3)
+//   -m mode         put, combine, values, updates or update (default updates)
+//   -c list         concurrency values, e.g. 1,4,16 (default 1,4,16)
+//   -b list         batch sizes, values per stream, e.g. 1,8 (default 1,8,32)
+//   -t seconds      duration of each run (default 5)
+//   -i interval_ms  sampling interval of each device, 0 sends as fast as
+//                   possible (default 0)
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+#include "stub_server.h"
+
+// Large enough for the biggest batches, the size must fit in uint16_t
+byte Ethernet::buffer[60000];
+
+namespace {
+
+enum Mode { kModePut, kModeCombine, kModeValues, kModeUpdates, kModeUpdate };
+
+struct Options {
+  int port;
+  int delay_ms;
+  int devices;
+  int streams;
+  Mode mode;
+  std::vector<int> concurrency;
+  std::vector<int> batches;
+  int seconds;
+  int interval_ms;
+};
+
+// Sampling profile of one virtual device: a sine wave with its own
+// period, amplitude and offset
+struct VirtualDevice {
+  std::string id;
+  std::vector<std::string> streams;
+  double base;
+  double amplitude;
+  double period;
+  unsigned long sequence;
+  unsigned long next_due;
+};
+
+struct Summary {
+  uint64_t requests;
+  uint64_t errors;
+  uint64_t bytes;
+  uint64_t samples;
+  uint64_t elapsed_micros;
+  uint64_t latency_count;
+};
+
+// Callbacks have no context argument, so the device being sent is global
+VirtualDevice* s_device;
+int s_stream;
+int s_batch;
+
+const time_t kBaseTime = 1400000000;
+
+void print_timestamp(Print* print, unsigned long offset) {
+  char buf[40];
+  time_t t = kBaseTime + s_device->sequence + offset;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  strftime(buf, sizeof(buf), "\"%Y-%m-%dT%H:%M:%S.000Z\"", &tm);
+  print->print(buf);
+}
+
+void print_sample(Print* print, int stream, unsigned long offset) {
+  double t = (double) (s_device->sequence + offset) + stream * 7;
+  print->print(s_device->base + s_device->amplitude *
+               sin(2 * M_PI * t / s_device->period));
+}
+
+void put_value_cb(Print* print) {
+  print_sample(print, s_stream, 0);
+}
+
+void values_timestamp_cb(Print* print, int index) {
+  print_timestamp(print, index);
+}
+
+void values_data_cb(Print* print, int index) {
+  // print_post_values quotes the value itself
+  print_sample(print, s_stream, index);
+}
+
+int updates_stream_cb(Print* print, int stream_index) {
+  print->print('"');
+  print->print(s_device->streams[stream_index].c_str());
+  print->print('"');
+  return s_batch;
+}
+
+void updates_timestamp_cb(Print* print, int value_index, int stream_index) {
+  print_timestamp(print, value_index);
+}
+
+void updates_data_cb(Print* print, int value_index, int stream_index) {
+  print_sample(print, stream_index, value_index);
+}
+
+void update_timestamp_cb(Print* print) {
+  print_timestamp(print, 0);
+}
+
+int update_stream_cb(Print* print, int stream_index) {
+  print->print('"');
+  print->print(s_device->streams[stream_index].c_str());
+  print->print('"');
+  return 1;
+}
+
+void update_data_cb(Print* print, int value_index, int stream_index) {
+  print_sample(print, stream_index, 0);
+}
+
+// Sends one request for the device, returns the status code and stores
+// the number of values sent in +samples+
+int send_device(M2XNanodeClient* client, VirtualDevice* device, Mode mode,
+                int batch, int* samples) {
+  int status = E_OK, streams = device->streams.size();
+  s_device = device;
+  s_batch = batch;
+
+  switch (mode) {
+    case kModePut:
+      s_stream = device->sequence % streams;
+      *samples = 1;
+      status = client->updateStreamValue(device->id.c_str(),
+                                         device->streams[s_stream].c_str(),
+                                         put_value_cb);
+      break;
+    case kModeCombine:
+      client->beginUpdate();
+      for (s_stream = 0; s_stream < streams; s_stream++) {
+        client->updateStreamValue(device->id.c_str(),
+                                  device->streams[s_stream].c_str(),
+                                  put_value_cb);
+      }
+      *samples = streams;
+      status = client->commitUpdate();
+      break;
+    case kModeValues:
+      s_stream = device->sequence % streams;
+      *samples = batch;
+      status = client->postStreamValues(device->id.c_str(),
+                                        device->streams[s_stream].c_str(),
+                                        batch, values_timestamp_cb,
+                                        values_data_cb);
+      break;
+    case kModeUpdates:
+      *samples = streams * batch;
+      status = client->postDeviceUpdates(device->id.c_str(), streams,
+                                         updates_stream_cb,
+                                         updates_timestamp_cb,
+                                         updates_data_cb);
+      break;
+    case kModeUpdate:
+      *samples = streams;
+      status = client->postDeviceUpdate(device->id.c_str(), streams,
+                                        update_timestamp_cb,
+                                        update_stream_cb, update_data_cb);
+      break;
+  }
+  device->sequence += batch;
+  return status;
+}
+
+uint64_t now_micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void write_all(int fd, const void* data, size_t size) {
+  const char* p = (const char*) data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) { return; }
+    p += n;
+    size -= n;
+  }
+}
+
+bool read_all(int fd, void* data, size_t size) {
+  char* p = (char*) data;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0) { return false; }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Runs in a worker process, serving devices [first, last)
+void run_worker(const Options& options, int batch, int first, int last,
+                int result_fd) {
+  std::vector<VirtualDevice> devices;
+  std::vector<uint32_t> latencies;
+  Summary summary;
+  IPAddress addr(127, 0, 0, 1);
+  char buf[32];
+
+  ether.begin(sizeof Ethernet::buffer, NULL);
+  srand(first + 1);
+  for (int i = first; i < last; i++) {
+    VirtualDevice device;
+    snprintf(buf, sizeof(buf), "loadgen-device-%05d", i);
+    device.id = buf;
+    for (int s = 0; s < options.streams; s++) {
+      snprintf(buf, sizeof(buf), "stream-%d", s);
+      device.streams.push_back(buf);
+    }
+    device.base = rand() % 100;
+    device.amplitude = 1 + rand() % 20;
+    device.period = 30 + rand() % 600;
+    device.sequence = 0;
+    // Spread the first samples over one interval
+    device.next_due = (options.interval_ms > 0) ? rand() % options.interval_ms : 0;
+    devices.push_back(device);
+  }
+
+  memset(&summary, 0, sizeof(summary));
+  uint64_t start = now_micros();
+  uint64_t deadline = start + (uint64_t) options.seconds * 1000000;
+  size_t next = 0;
+
+  while (!devices.empty() && (now_micros() < deadline)) {
+    VirtualDevice* device;
+    if (options.interval_ms > 0) {
+      // Earliest due device goes next, wait if it is not due yet
+      device = &devices[0];
+      for (size_t i = 1; i < devices.size(); i++) {
+        if (devices[i].next_due < device->next_due) { device = &devices[i]; }
+      }
+      uint64_t due = start + (uint64_t) device->next_due * 1000;
+      uint64_t now = now_micros();
+      if (due > now) {
+        if (due >= deadline) { break; }
+        usleep(due - now);
+      }
+      device->next_due += options.interval_ms;
+    } else {
+      device = &devices[next];
+      next = (next + 1) % devices.size();
+    }
+
+    M2XNanodeClient client("loadgen-key", &addr, 5, 1, options.port);
+    int samples = 0;
+    uint64_t before = now_micros();
+    int status = send_device(&client, device, options.mode, batch, &samples);
+    latencies.push_back(now_micros() - before);
+
+    summary.requests++;
+    if ((status < 200) || (status >= 300)) {
+      summary.errors++;
+    } else {
+      summary.samples += samples;
+    }
+    summary.bytes += client.lastRequestLength();
+  }
+
+  summary.elapsed_micros = now_micros() - start;
+  summary.latency_count = latencies.size();
+  write_all(result_fd, &summary, sizeof(summary));
+  if (!latencies.empty()) {
+    write_all(result_fd, &latencies[0], latencies.size() * sizeof(uint32_t));
+  }
+}
+
+double percentile_millis(std::vector<uint32_t>* sorted, double p) {
+  if (sorted->empty()) { return 0; }
+  size_t index = (size_t) (p * (sorted->size() - 1) + 0.5);
+  return (*sorted)[index] / 1000.0;
+}
+
+void run(const Options& options, int concurrency, int batch) {
+  std::vector<pid_t> pids;
+  std::vector<int> fds;
+  int workers = std::min(concurrency, options.devices);
+
+  for (int w = 0; w < workers; w++) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0) { perror("pipe"); exit(1); }
+    int first = (long) options.devices * w / workers;
+    int last = (long) options.devices * (w + 1) / workers;
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(pipe_fds[0]);
+      run_worker(options, batch, first, last, pipe_fds[1]);
+      _exit(0);
+    }
+    close(pipe_fds[1]);
+    pids.push_back(pid);
+    fds.push_back(pipe_fds[0]);
+  }
+
+  Summary total;
+  std::vector<uint32_t> latencies;
+  uint64_t elapsed = 0;
+  memset(&total, 0, sizeof(total));
+  for (size_t w = 0; w < fds.size(); w++) {
+    Summary summary;
+    if (read_all(fds[w], &summary, sizeof(summary))) {
+      size_t offset = latencies.size();
+      latencies.resize(offset + summary.latency_count);
+      if ((summary.latency_count > 0) &&
+          !read_all(fds[w], &latencies[offset], summary.latency_count * sizeof(uint32_t))) {
+        latencies.resize(offset);
+      }
+      total.requests += summary.requests;
+      total.errors += summary.errors;
+      total.bytes += summary.bytes;
+      total.samples += summary.samples;
+      elapsed = std::max(elapsed, summary.elapsed_micros);
+    }
+    close(fds[w]);
+    waitpid(pids[w], NULL, 0);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  double seconds = elapsed / 1e6;
+  if (seconds <= 0) { seconds = 1; }
+  printf("%11d %5d %9llu %9.1f %11.0f %10.1f %8.2f %8.2f %7llu\n",
+         concurrency, batch, (unsigned long long) total.requests,
+         total.requests / seconds, total.bytes / seconds,
+         total.samples / seconds, percentile_millis(&latencies, 0.5),
+         percentile_millis(&latencies, 0.99),
+         (unsigned long long) total.errors);
+  fflush(stdout);
+}
+
+std::vector<int> parse_list(const char* s) {
+  std::vector<int> values;
+  std::string item;
+  for (const char* p = s; ; p++) {
+    if ((*p == ',') || (*p == '\0')) {
+      if (!item.empty() && atoi(item.c_str()) > 0) {
+        values.push_back(atoi(item.c_str()));
+      }
+      item.clear();
+      if (*p == '\0') { break; }
+    } else {
+      item += *p;
+    }
+  }
+  return values;
+}
+
+bool parse_mode(const char* s, Mode* mode) {
+  static const char* const kNames[] = { "put", "combine", "values", "updates", "update" };
+  for (int i = 0; i < 5; i++) {
+    if (strcmp(s, kNames[i]) == 0) {
+      *mode = (Mode) i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [-p port] [-d delay_ms] [-n devices] [-s streams]\n"
+          "       [-m put|combine|values|updates|update] [-c concurrency,...]\n"
+          "       [-b batch,...] [-t seconds] [-i interval_ms]\n", name);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  pid_t server_pid = 0;
+  int c;
+
+  options.port = 0;
+  options.delay_ms = 0;
+  options.devices = 1000;
+  options.streams = 3;
+  options.mode = kModeUpdates;
+  options.concurrency = parse_list("1,4,16");
+  options.batches = parse_list("1,8,32");
+  options.seconds = 5;
+  options.interval_ms = 0;
+
+  while ((c = getopt(argc, argv, "p:d:n:s:m:c:b:t:i:")) != -1) {
+    switch (c) {
+      case 'p': options.port = atoi(optarg); break;
+      case 'd': options.delay_ms = atoi(optarg); break;
+      case 'n': options.devices = atoi(optarg); break;
+      case 's': options.streams = atoi(optarg); break;
+      case 'm':
+        if (!parse_mode(optarg, &options.mode)) { usage(argv[0]); return 1; }
+        break;
+      case 'c': options.concurrency = parse_list(optarg); break;
+      case 'b': options.batches = parse_list(optarg); break;
+      case 't': options.seconds = atoi(optarg); break;
+      case 'i': options.interval_ms = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if ((options.devices <= 0) || (options.streams <= 0) ||
+      options.concurrency.empty() || options.batches.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  if ((options.mode == kModePut) || (options.mode == kModeCombine) ||
+      (options.mode == kModeUpdate)) {
+    // These requests always carry one value per stream
+    options.batches = std::vector<int>(1, 1);
+  }
+
+  if (options.port == 0) {
+    StubServerOptions server = { 0, 64, options.delay_ms, false };
+    int fd = stub_server_listen(&server);
+    if (fd < 0) {
+      perror("listen");
+      return 1;
+    }
+    server_pid = fork();
+    if (server_pid == 0) {
+      stub_server_run(fd, server);
+      _exit(0);
+    }
+    close(fd);
+    options.port = server.port;
+    fprintf(stderr, "Stand-in server on 127.0.0.1:%d\n", options.port);
+  }
+
+  printf("concurrency batch  requests     req/s     bytes/s  samples/s  p50 ms  p99 ms  errors\n");
+  for (size_t i = 0; i < options.concurrency.size(); i++) {
+    for (size_t j = 0; j < options.batches.size(); j++) {
+      run(options, options.concurrency[i], options.batches[j]);
+    }
+  }
+
+  if (server_pid > 0) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+  }
+  return 0;
+}
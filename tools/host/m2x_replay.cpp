@@ -0,0 +1,290 @@
+// Replays a traffic capture printed by M2XTrafficRecorder::dump through
+// the request header builder and the response parser of the client
+// library, to reproduce timing and parsing behavior of a field device
+// offline.
+//
+// Usage: m2x_replay [capture file]
+//
+// Lines not starting with "M2X " are ignored, so a whole Serial log can
+// be passed in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+
+byte Ethernet::buffer[1500];
+
+namespace {
+
+const int kParseIterations = 10000;
+
+struct Segment {
+  char type;
+  unsigned long timestamp;
+  int length;
+  std::string data;
+};
+
+struct ReplayStats {
+  int requests;
+  int responses;
+  int timeouts;
+  int errors;
+  int mismatches;
+  unsigned long rtt_count;
+  unsigned long rtt_total;
+  unsigned long rtt_min;
+  unsigned long rtt_max;
+};
+
+class StringPrint : public Print {
+public:
+  virtual size_t write(uint8_t b) {
+    data += (char) b;
+    return 1;
+  }
+  std::string data;
+};
+
+int hex_value(char c) {
+  if ((c >= '0') && (c <= '9')) { return c - '0'; }
+  if ((c >= 'A') && (c <= 'F')) { return c - 'A' + 10; }
+  if ((c >= 'a') && (c <= 'f')) { return c - 'a' + 10; }
+  return -1;
+}
+
+bool parse_segment(const std::string& line, Segment* segment) {
+  std::istringstream in(line);
+  std::string tag, type, hex;
+  if (!(in >> tag >> type >> segment->timestamp >> segment->length) ||
+      (tag != "M2X") || (type.size() != 1)) {
+    return false;
+  }
+  in >> hex;
+  segment->type = type[0];
+  segment->data.clear();
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    int high = hex_value(hex[i]), low = hex_value(hex[i + 1]);
+    if ((high < 0) || (low < 0)) { return false; }
+    segment->data += (char) (high * 16 + low);
+  }
+  return true;
+}
+
+std::string first_line(const std::string& data) {
+  size_t end = data.find("\r\n");
+  return data.substr(0, end);
+}
+
+// Returns the value of header +name+ in +data+, or an empty string
+std::string header_value(const std::string& data, const char* name) {
+  std::string key = std::string("\r\n") + name + ": ";
+  size_t start = data.find(key);
+  if (start == std::string::npos) { return std::string(); }
+  start += key.size();
+  return data.substr(start, data.find("\r\n", start) - start);
+}
+
+double now_nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Checks the header lines kept in a truncated capture against the header
+// the client builds. The body is missing, so Content-Length is taken from
+// the capture, and a line cut off by the capture is only compared as far
+// as it goes, unless its value is not known.
+void replay_truncated_request(const Segment& segment, ReplayStats* stats) {
+  const std::string& data = segment.data;
+  size_t line_end = data.find("\r\n");
+  if (line_end == std::string::npos) {
+    printf("            truncated capture, request line only\n");
+    return;
+  }
+
+  std::string captured = data.substr(line_end + 2);
+  size_t header_end = captured.find("\r\n\r\n");
+  if (header_end != std::string::npos) {
+    captured.erase(header_end + 4);
+  }
+
+  std::string key = header_value(data, "X-M2X-KEY");
+  std::string length = header_value(data, "Content-Length");
+  bool key_known = data.find("\r\n", data.find("X-M2X-KEY: ")) != std::string::npos;
+  bool length_known = data.find("\r\n", data.find("Content-Length: ")) != std::string::npos;
+  int content_length = 0;
+  if (length_known) {
+    content_length = atoi(length.c_str());
+  } else if (header_end == std::string::npos) {
+    // Any positive length gives the same lines before Content-Length
+    content_length = 1;
+  }
+  IPAddress addr;
+  M2XNanodeClient client(key.c_str(), &addr);
+  StringPrint rebuilt;
+  client.writeHttpHeader(&rebuilt, content_length);
+  size_t compared = captured.size();
+  size_t last_line = captured.rfind("\r\n");
+  last_line = (last_line == std::string::npos) ? 0 : last_line + 2;
+  if ((last_line < captured.size()) &&
+      (((captured.compare(last_line, 9, "X-M2X-KEY") == 0) && !key_known) ||
+       ((captured.compare(last_line, 14, "Content-Length") == 0) && !length_known))) {
+    compared = last_line;
+  }
+
+  if (rebuilt.data.compare(0, compared, captured, 0, compared) != 0) {
+    stats->mismatches++;
+    printf("            MISMATCH: captured header lines differ from the library\n");
+    return;
+  }
+  if (compared == 0) {
+    printf("            truncated capture, request line only\n");
+    return;
+  }
+  printf("            truncated capture, %d header bytes checked%s\n",
+         (int) compared,
+         (header_end != std::string::npos) ?
+             ", Content-Length not checked against the body" : "");
+}
+
+// Rebuilds the request header with the client and compares it with the
+// captured one. Truncated captures are checked as far as they go.
+void replay_request(const Segment& segment, ReplayStats* stats) {
+  const std::string& data = segment.data;
+  bool complete = (int) data.size() == segment.length;
+  size_t header_end = data.find("\r\n\r\n");
+
+  printf("%10lu  >  %5d bytes  %s\n", segment.timestamp, segment.length,
+         first_line(data).c_str());
+  if (!complete || (header_end == std::string::npos)) {
+    replay_truncated_request(segment, stats);
+    return;
+  }
+
+  std::string key = header_value(data, "X-M2X-KEY");
+  int body_length = data.size() - (header_end + 4);
+  IPAddress addr;
+  M2XNanodeClient client(key.c_str(), &addr);
+  StringPrint rebuilt;
+  client.writeHttpHeader(&rebuilt, body_length);
+
+  size_t line_end = data.find("\r\n");
+  std::string captured = data.substr(line_end + 2, header_end + 4 - (line_end + 2));
+  if (captured != rebuilt.data) {
+    stats->mismatches++;
+    printf("            MISMATCH: header does not match a %d byte body\n", body_length);
+    printf("            captured Content-Length: %s\n",
+           header_value(data, "Content-Length").c_str());
+  }
+}
+
+void replay_response(const Segment& segment, M2XNanodeClient* client,
+                     ReplayStats* stats) {
+  const char* origin = segment.data.data();
+  int len = segment.data.size();
+  int status = 0, content_length = 0, header_length = 0;
+
+  double start = now_nanos();
+  for (int i = 0; i < kParseIterations; i++) {
+    status = client->readStatusCode(origin, len);
+    content_length = client->readContentLength(origin, len);
+    header_length = client->skipHttpHeader(origin, len);
+  }
+  double parse_nanos = (now_nanos() - start) / kParseIterations;
+
+  printf("%10lu  <  %5d bytes  status %d, content length %d, header %d, "
+         "parsed in %.0f ns%s\n",
+         segment.timestamp, segment.length, status, content_length,
+         header_length, parse_nanos,
+         (len < segment.length) ? " (truncated capture)" : "");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::ifstream file;
+  std::istream* in = &std::cin;
+  std::string line;
+  Segment segment;
+  ReplayStats stats;
+  unsigned long last_request = 0;
+  bool waiting = false;
+  IPAddress addr;
+  M2XNanodeClient client("", &addr);
+
+  if (argc > 1) {
+    file.open(argv[1]);
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", argv[1]);
+      return 1;
+    }
+    in = &file;
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  while (std::getline(*in, line)) {
+    if (!line.empty() && (line[line.size() - 1] == '\r')) {
+      line.erase(line.size() - 1);
+    }
+    if ((line.compare(0, 4, "M2X ") != 0) || !parse_segment(line, &segment)) {
+      continue;
+    }
+
+    switch (segment.type) {
+      case '>':
+        stats.requests++;
+        replay_request(segment, &stats);
+        last_request = segment.timestamp;
+        waiting = true;
+        break;
+      case '<':
+        stats.responses++;
+        replay_response(segment, &client, &stats);
+        if (waiting) {
+          unsigned long rtt = segment.timestamp - last_request;
+          printf("            round trip %lu ms\n", rtt);
+          if ((stats.rtt_count == 0) || (rtt < stats.rtt_min)) { stats.rtt_min = rtt; }
+          if (rtt > stats.rtt_max) { stats.rtt_max = rtt; }
+          stats.rtt_total += rtt;
+          stats.rtt_count++;
+          waiting = false;
+        }
+        break;
+      case 'x':
+        stats.errors++;
+        printf("%10lu  x  connection error, status %d%s after %lu ms\n",
+               segment.timestamp,
+               segment.data.empty() ? -1 : (uint8_t) segment.data[0],
+               (!segment.data.empty() && (segment.data[0] == 3)) ? " (reset)" : "",
+               waiting ? segment.timestamp - last_request : 0UL);
+        waiting = false;
+        break;
+      default:
+        stats.timeouts++;
+        printf("%10lu  !  timeout after %lu ms\n", segment.timestamp,
+               waiting ? segment.timestamp - last_request : 0UL);
+        waiting = false;
+        break;
+    }
+  }
+
+  printf("\n%d requests, %d responses, %d timeouts, %d connection errors, "
+         "%d header mismatches\n", stats.requests, stats.responses,
+         stats.timeouts, stats.errors, stats.mismatches);
+  if (stats.rtt_count > 0) {
+    printf("round trip min/avg/max: %lu/%lu/%lu ms\n", stats.rtt_min,
+           stats.rtt_total / stats.rtt_count, stats.rtt_max);
+  }
+  return (stats.mismatches > 0) ? 2 : 0;
+}
@@ -0,0 +1,114 @@
+// Measures response parsing throughput of the client library on large
+// response headers: readStatusCode, readContentLength and skipHttpHeader
+// are run over the same response many times.
+//
+// The Makefile builds this once per scanning backend (scalar, SSE2 and
+// AVX2). Each build also parses a fixed set of random responses and
+// prints a checksum of the results, which must be the same for every
+// backend.
+//
+// Usage: m2x_scan_bench [header bytes] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+
+#include <EtherCard.h>
+
+#include "M2XNanodeClient.h"
+
+byte Ethernet::buffer[1500];
+
+namespace {
+
+const char* const kBackend =
+#if defined(M2X_SCAN_SCALAR) || defined(__AVR__) || !defined(__SSE2__)
+    "scalar";
+#elif defined(__AVX2__)
+    "avx2";
+#else
+    "sse2";
+#endif
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A response whose Content-Length header comes after +header_bytes+ of
+// other headers, like the ones added by proxies and load balancers
+std::string large_response(int header_bytes) {
+  std::string response = "HTTP/1.1 200 OK\r\n";
+  char line[128];
+  for (int i = 0; response.size() < (size_t) header_bytes; i++) {
+    snprintf(line, sizeof(line), "X-Proxy-Header-%d: value-%08x-%08x; Path=/v2/devices\r\n",
+             i, i * 2654435761u, i * 40503u);
+    response += line;
+  }
+  response += "content-length: 10\r\n\r\n1400000000";
+  return response;
+}
+
+// Random responses mixing fragments of the patterns, so partial matches,
+// matches at vector boundaries and matches near the end are all covered
+std::string random_response(unsigned int* seed) {
+  static const char* const kFragments[] = {
+    "HTTP/1.1 ", "HTTP/", "Content-Length: ", "CONTENT-length: ", "Content-",
+    "\r\n", "\n\r\n", "\r", "\n", "x", "Y: z", "200", "7", "HTTP/1.0 404 ",
+    "C", "c", "ontent", "H", "T", " ",
+  };
+  std::string response;
+  int parts = rand_r(seed) % 40;
+  for (int i = 0; i < parts; i++) {
+    response += kFragments[rand_r(seed) % (sizeof(kFragments) / sizeof(kFragments[0]))];
+  }
+  return response;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int header_bytes = (argc > 1) ? atoi(argv[1]) : 4096;
+  int iterations = (argc > 2) ? atoi(argv[2]) : 20000;
+  IPAddress addr;
+  M2XNanodeClient client("", &addr);
+  M2XNanodeClient case_sensitive("", &addr, 15, 0);
+  unsigned long checksum = 0;
+  unsigned int seed = 1;
+
+  for (int i = 0; i < 200000; i++) {
+    std::string response = random_response(&seed);
+    M2XNanodeClient* c = (i % 2) ? &client : &case_sensitive;
+    int results[3] = {
+      c->readStatusCode(response.data(), response.size()),
+      c->readContentLength(response.data(), response.size()),
+      c->skipHttpHeader(response.data(), response.size()),
+    };
+    for (int k = 0; k < 3; k++) {
+      checksum = checksum * 31 + (unsigned long) results[k];
+    }
+  }
+
+  std::string response = large_response(header_bytes);
+  const char* origin = response.data();
+  int len = response.size();
+  int status = 0, content_length = 0, header_length = 0;
+
+  double start = now_seconds();
+  for (int i = 0; i < iterations; i++) {
+    status = client.readStatusCode(origin, len);
+    content_length = client.readContentLength(origin, len);
+    header_length = client.skipHttpHeader(origin, len);
+  }
+  double elapsed = now_seconds() - start;
+
+  printf("%-6s  %d byte response: status %d, content length %d, header %d\n",
+         kBackend, len, status, content_length, header_length);
+  printf("%-6s  %.2f us per response, %.1f MB/s, checksum %lx\n",
+         kBackend, elapsed / iterations * 1e6,
+         (double) len * iterations / elapsed / 1e6, checksum);
+  return 0;
+}
@@ -0,0 +1,36 @@
+// Stand-in M2X API server for testing the client library on a host.
+// Start several instances on different ports to test failover.
+//
+// Usage: m2x_stub_server [-p port] [-w workers] [-d delay_ms] [-v]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "stub_server.h"
+
+int main(int argc, char** argv) {
+  StubServerOptions options = { 8080, 16, 0, false };
+  int c;
+
+  while ((c = getopt(argc, argv, "p:w:d:v")) != -1) {
+    switch (c) {
+      case 'p': options.port = atoi(optarg); break;
+      case 'w': options.workers = atoi(optarg); break;
+      case 'd': options.delay_ms = atoi(optarg); break;
+      case 'v': options.verbose = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-p port] [-w workers] [-d delay_ms] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  int fd = stub_server_listen(&options);
+  if (fd < 0) {
+    perror("listen");
+    return 1;
+  }
+  fprintf(stderr, "Listening on 127.0.0.1:%d\n", options.port);
+  stub_server_run(fd, options);
+  return 0;
+}
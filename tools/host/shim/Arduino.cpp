@@ -0,0 +1,26 @@
+#include "Arduino.h"
+
+#include <time.h>
+
+static uint64_t monotonic_micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t s_start = monotonic_micros();
+
+unsigned long millis() {
+  return (monotonic_micros() - s_start) / 1000;
+}
+
+unsigned long micros() {
+  return monotonic_micros() - s_start;
+}
+
+void delay(unsigned long ms) {
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep(&ts, NULL);
+}
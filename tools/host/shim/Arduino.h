@@ -0,0 +1,24 @@
+// Minimal Arduino core for building the client library on a host
+// machine, only what the library and the host tools use is provided.
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Print.h"
+#include "IPAddress.h"
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define pgm_read_word(p) (*(const uint16_t*) (p))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+#endif  /* Arduino_h */
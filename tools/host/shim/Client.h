@@ -0,0 +1,7 @@
+#ifndef Client_h
+#define Client_h
+
+// The client library only needs this header to exist on host builds
+#include "Print.h"
+
+#endif  /* Client_h */
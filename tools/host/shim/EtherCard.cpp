@@ -0,0 +1,185 @@
+#include "EtherCard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+EtherCard ether;
+uint8_t EtherCard::hisip[4];
+uint16_t EtherCard::maxPacketSize = 1460;
+
+namespace {
+
+enum State { kIdle, kConnecting, kSending, kReceiving };
+
+typedef uint8_t (*result_callback)(uint8_t, uint8_t, uint16_t, uint16_t);
+typedef uint16_t (*datafill_callback)(uint8_t);
+
+struct Connection {
+  State state;
+  int sock;
+  uint8_t fd;
+  result_callback result_cb;
+  datafill_callback datafill_cb;
+  std::string out;
+  size_t sent;
+  std::string in;
+  size_t delivered;
+  bool header_complete;
+};
+
+uint16_t s_buffer_size;
+uint8_t s_next_fd;
+Connection s_conn = { kIdle, -1, 0, NULL, NULL, std::string(), 0, std::string(), 0, false };
+
+void close_connection() {
+  if (s_conn.sock >= 0) { close(s_conn.sock); }
+  s_conn.sock = -1;
+  s_conn.state = kIdle;
+}
+
+bool wait_for(short events) {
+  struct pollfd pfd;
+  pfd.fd = s_conn.sock;
+  pfd.events = events;
+  pfd.revents = 0;
+  // Sleeping a little here keeps the client's busy loop off the CPU
+  return poll(&pfd, 1, 1) > 0;
+}
+
+void start_connection(uint16_t port) {
+  struct sockaddr_in addr;
+  s_conn.sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (s_conn.sock < 0) { s_conn.state = kIdle; return; }
+  fcntl(s_conn.sock, F_SETFL, fcntl(s_conn.sock, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(s_conn.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  memcpy(&addr.sin_addr.s_addr, EtherCard::hisip, 4);
+  if ((connect(s_conn.sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) &&
+      (errno != EINPROGRESS)) {
+    // Like a lost SYN on the board: no callback, the client times out
+    close_connection();
+    return;
+  }
+  s_conn.state = kConnecting;
+}
+
+void fill_request() {
+  uint16_t length = s_conn.datafill_cb(s_conn.fd);
+  s_conn.out.assign((const char*) Ethernet::buffer + ETHERCARD_TCP_DATA_OFFSET, length);
+  s_conn.sent = 0;
+  s_conn.state = kSending;
+}
+
+// Hands received data to the result callback in packet sized pieces
+void deliver() {
+  size_t capacity = s_buffer_size - ETHERCARD_TCP_DATA_OFFSET;
+  if (capacity > EtherCard::maxPacketSize) { capacity = EtherCard::maxPacketSize; }
+
+  while ((s_conn.state == kReceiving) && (s_conn.delivered < s_conn.in.size())) {
+    size_t length = s_conn.in.size() - s_conn.delivered;
+    if (length > capacity) { length = capacity; }
+    memcpy(Ethernet::buffer + ETHERCARD_TCP_DATA_OFFSET,
+           s_conn.in.data() + s_conn.delivered, length);
+    s_conn.delivered += length;
+    if (s_conn.result_cb(s_conn.fd, 0, ETHERCARD_TCP_DATA_OFFSET, length) == 1) {
+      // The callback asked for FIN
+      close_connection();
+    }
+  }
+}
+
+}  // namespace
+
+uint8_t EtherCard::begin(uint16_t size, const uint8_t* macaddr, uint8_t csPin) {
+  s_buffer_size = size;
+  return 1;
+}
+
+uint8_t EtherCard::clientTcpReq(result_callback result_cb,
+                                datafill_callback datafill_cb,
+                                uint16_t port) {
+  // Only one connection at a time, like on the board
+  close_connection();
+  s_conn.fd = s_next_fd;
+  s_next_fd = (s_next_fd + 1) & 7;
+  s_conn.result_cb = result_cb;
+  s_conn.datafill_cb = datafill_cb;
+  s_conn.in.clear();
+  s_conn.delivered = 0;
+  s_conn.header_complete = false;
+  start_connection(port);
+  return s_conn.fd;
+}
+
+uint16_t EtherCard::packetReceive() {
+  return 0;
+}
+
+uint16_t EtherCard::packetLoop(uint16_t plen) {
+  char chunk[2048];
+  ssize_t n;
+  int error;
+  socklen_t error_length = sizeof(error);
+
+  switch (s_conn.state) {
+    case kIdle:
+      break;
+    case kConnecting:
+      if (!wait_for(POLLOUT)) { break; }
+      if ((getsockopt(s_conn.sock, SOL_SOCKET, SO_ERROR, &error, &error_length) < 0) ||
+          (error != 0)) {
+        close_connection();
+        if (error == ECONNREFUSED) {
+          // ethercard reports a reset with status code 3
+          s_conn.result_cb(s_conn.fd, 3, 0, 0);
+        }
+        break;
+      }
+      fill_request();
+      // Fall through to send right away
+    case kSending:
+      n = send(s_conn.sock, s_conn.out.data() + s_conn.sent,
+               s_conn.out.size() - s_conn.sent, MSG_NOSIGNAL);
+      if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) { close_connection(); }
+        break;
+      }
+      s_conn.sent += n;
+      if (s_conn.sent == s_conn.out.size()) { s_conn.state = kReceiving; }
+      break;
+    case kReceiving:
+      if (!wait_for(POLLIN)) { break; }
+      n = recv(s_conn.sock, chunk, sizeof(chunk), 0);
+      if (n < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) { close_connection(); }
+        break;
+      }
+      if (n > 0) {
+        s_conn.in.append(chunk, n);
+        // The server sends the header in one segment, wait for all of it
+        if (!s_conn.header_complete &&
+            (s_conn.in.find("\r\n\r\n") == std::string::npos)) {
+          break;
+        }
+        s_conn.header_complete = true;
+        deliver();
+      } else {
+        // Server closed the connection, hand over whatever is left
+        deliver();
+        close_connection();
+      }
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+// Host replacement for the ethercard library. Requests are sent over real
+// TCP sockets of the host, one connection at a time, driven by
+// packetLoop() just like on the board.
+#ifndef EtherCard_h
+#define EtherCard_h
+
+#include "Arduino.h"
+
+// Offset of the TCP payload in Ethernet::buffer, same as on the board
+#define ETHERCARD_TCP_DATA_OFFSET 54
+
+class BufferFiller : public Print {
+public:
+  BufferFiller() : _start(NULL), _ptr(NULL) {}
+  BufferFiller(uint8_t* buf) : _start(buf), _ptr(buf) {}
+
+  uint8_t* buffer() const { return _start; }
+  uint16_t position() const { return _ptr - _start; }
+
+  virtual size_t write(uint8_t v) {
+    *_ptr++ = v;
+    return 1;
+  }
+
+private:
+  uint8_t* _start;
+  uint8_t* _ptr;
+};
+
+class Ethernet {
+public:
+  // Defined by the program, like in sketches
+  static uint8_t buffer[];
+};
+
+class EtherCard : public Ethernet {
+public:
+  static uint8_t hisip[4];
+
+  // Only records the buffer size, +macaddr+ is ignored
+  static uint8_t begin(uint16_t size, const uint8_t* macaddr, uint8_t csPin = 8);
+
+  static BufferFiller tcpOffset() {
+    return BufferFiller(buffer + ETHERCARD_TCP_DATA_OFFSET);
+  }
+
+  static uint8_t clientTcpReq(uint8_t (*result_cb)(uint8_t, uint8_t, uint16_t, uint16_t),
+                              uint16_t (*datafill_cb)(uint8_t),
+                              uint16_t port);
+
+  static uint16_t packetReceive();
+  static uint16_t packetLoop(uint16_t plen);
+
+  // Largest response, in bytes, delivered to the result callback in one
+  // packet. Real ethercard splits responses at the Ethernet MTU.
+  static uint16_t maxPacketSize;
+};
+
+extern EtherCard ether;
+
+#endif  /* EtherCard_h */
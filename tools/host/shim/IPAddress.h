@@ -0,0 +1,23 @@
+#ifndef IPAddress_h
+#define IPAddress_h
+
+#include <stdint.h>
+
+class IPAddress {
+public:
+  IPAddress() { _address[0] = _address[1] = _address[2] = _address[3] = 0; }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    _address[0] = a; _address[1] = b; _address[2] = c; _address[3] = d;
+  }
+  IPAddress(const uint8_t* address) {
+    for (int i = 0; i < 4; i++) { _address[i] = address[i]; }
+  }
+
+  uint8_t operator[](int index) const { return _address[index]; }
+  uint8_t& operator[](int index) { return _address[index]; }
+
+private:
+  uint8_t _address[4];
+};
+
+#endif  /* IPAddress_h */
@@ -0,0 +1,53 @@
+#include "Print.h"
+
+#include <stdio.h>
+#include <string.h>
+
+size_t Print::write(const uint8_t* buf, size_t size) {
+  size_t n = 0;
+  while (size--) { n += write(*buf++); }
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper* s) {
+  return print(reinterpret_cast<const char*>(s));
+}
+
+size_t Print::print(const char* s) {
+  return write(reinterpret_cast<const uint8_t*>(s), strlen(s));
+}
+
+size_t Print::print(char c) {
+  return write(static_cast<uint8_t>(c));
+}
+
+size_t Print::print(int n) { return print(static_cast<long>(n)); }
+size_t Print::print(unsigned int n) { return print(static_cast<unsigned long>(n)); }
+
+size_t Print::print(long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  return print(buf);
+}
+
+size_t Print::print(unsigned long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  return print(buf);
+}
+
+size_t Print::print(double n) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.2f", n);
+  return print(buf);
+}
+
+size_t Print::println() { return print("\r\n"); }
+size_t Print::println(const __FlashStringHelper* s) { return print(s) + println(); }
+size_t Print::println(const char* s) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int n) { return print(n) + println(); }
+size_t Print::println(unsigned int n) { return print(n) + println(); }
+size_t Print::println(long n) { return print(n) + println(); }
+size_t Print::println(unsigned long n) { return print(n) + println(); }
+size_t Print::println(double n) { return print(n) + println(); }
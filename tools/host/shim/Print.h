@@ -0,0 +1,38 @@
+#ifndef Print_h
+#define Print_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+// Same interface as the Arduino Print class, numbers are printed in
+// base 10 and doubles with 2 decimals
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size);
+
+  size_t print(const __FlashStringHelper* s);
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(int n);
+  size_t print(unsigned int n);
+  size_t print(long n);
+  size_t print(unsigned long n);
+  size_t print(double n);
+
+  size_t println();
+  size_t println(const __FlashStringHelper* s);
+  size_t println(const char* s);
+  size_t println(char c);
+  size_t println(int n);
+  size_t println(unsigned int n);
+  size_t println(long n);
+  size_t println(unsigned long n);
+  size_t println(double n);
+};
+
+#endif  /* Print_h */
@@ -0,0 +1,259 @@
+#include "stub_server.h"
+
+#include <ctype.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Minimal JSON parser, only checking that the body is well formed so
+// serializer bugs show up as 400 responses
+class JsonChecker {
+public:
+  explicit JsonChecker(const std::string& text) : _text(text), _pos(0) {}
+
+  bool valid() {
+    if (!value(0)) { return false; }
+    skip_space();
+    return _pos == _text.size();
+  }
+
+private:
+  static const int kMaxDepth = 32;
+  const std::string& _text;
+  size_t _pos;
+
+  void skip_space() {
+    while ((_pos < _text.size()) && strchr(" \t\r\n", _text[_pos])) { _pos++; }
+  }
+
+  bool consume(char c) {
+    skip_space();
+    if ((_pos < _text.size()) && (_text[_pos] == c)) {
+      _pos++;
+      return true;
+    }
+    return false;
+  }
+
+  bool literal(const char* word) {
+    size_t n = strlen(word);
+    if (_text.compare(_pos, n, word) != 0) { return false; }
+    _pos += n;
+    return true;
+  }
+
+  bool string() {
+    if (!consume('"')) { return false; }
+    while (_pos < _text.size()) {
+      char c = _text[_pos++];
+      if (c == '"') { return true; }
+      if ((unsigned char) c < 0x20) { return false; }
+      if (c == '\\') {
+        if (_pos >= _text.size() || !strchr("\"\\/bfnrtu", _text[_pos])) {
+          return false;
+        }
+        _pos++;
+      }
+    }
+    return false;
+  }
+
+  bool digits() {
+    size_t start = _pos;
+    while ((_pos < _text.size()) && isdigit((unsigned char) _text[_pos])) { _pos++; }
+    return _pos > start;
+  }
+
+  bool number() {
+    if ((_pos < _text.size()) && (_text[_pos] == '-')) { _pos++; }
+    if (!digits()) { return false; }
+    if ((_pos < _text.size()) && (_text[_pos] == '.')) {
+      _pos++;
+      if (!digits()) { return false; }
+    }
+    if ((_pos < _text.size()) && ((_text[_pos] == 'e') || (_text[_pos] == 'E'))) {
+      _pos++;
+      if ((_pos < _text.size()) && ((_text[_pos] == '+') || (_text[_pos] == '-'))) { _pos++; }
+      if (!digits()) { return false; }
+    }
+    return true;
+  }
+
+  bool value(int depth) {
+    if (depth > kMaxDepth) { return false; }
+    skip_space();
+    if (_pos >= _text.size()) { return false; }
+    switch (_text[_pos]) {
+      case '{':
+        _pos++;
+        if (consume('}')) { return true; }
+        do {
+          if (!string() || !consume(':') || !value(depth + 1)) { return false; }
+        } while (consume(','));
+        return consume('}');
+      case '[':
+        _pos++;
+        if (consume(']')) { return true; }
+        do {
+          if (!value(depth + 1)) { return false; }
+        } while (consume(','));
+        return consume(']');
+      case '"':
+        return string();
+      case 't':
+        return literal("true");
+      case 'f':
+        return literal("false");
+      case 'n':
+        return literal("null");
+      default:
+        return number();
+    }
+  }
+};
+
+bool valid_json(const std::string& body) {
+  return JsonChecker(body).valid();
+}
+
+bool starts_with(const std::string& s, const char* prefix) {
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+bool ends_with(const std::string& s, const char* suffix) {
+  size_t n = strlen(suffix);
+  return (s.size() >= n) && (s.compare(s.size() - n, n, suffix) == 0);
+}
+
+std::string respond(const std::string& method, const std::string& path,
+                    const std::string& body, bool length_ok) {
+  const char* status = NULL;
+  std::string content;
+
+  if (starts_with(path, "/v2/time/")) {
+    char buf[32];
+    time_t now = time(NULL);
+    if (ends_with(path, "/seconds")) {
+      snprintf(buf, sizeof(buf), "%ld", (long) now);
+    } else if (ends_with(path, "/millis")) {
+      snprintf(buf, sizeof(buf), "%ld000", (long) now);
+    } else {
+      strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S.000Z", gmtime(&now));
+    }
+    status = "200 OK";
+    content = buf;
+  } else if (!starts_with(path, "/v2/devices/")) {
+    status = "404 Not Found";
+  } else if (!length_ok || (!body.empty() && !valid_json(body))) {
+    status = "400 Bad Request";
+  } else if (method == "DELETE") {
+    status = "204 No Content";
+  } else if (method == "PUT" || method == "POST") {
+    status = "202 Accepted";
+  } else {
+    status = "405 Method Not Allowed";
+  }
+
+  std::string response = std::string("HTTP/1.1 ") + status + "\r\n";
+  response += "Content-Type: application/json\r\n";
+  response += "Content-Length: " + std::to_string(content.size()) + "\r\n";
+  response += "Connection: close\r\n\r\n";
+  response += content;
+  return response;
+}
+
+void serve(int conn, const StubServerOptions& options) {
+  std::string in;
+  char chunk[4096];
+  size_t header_end = std::string::npos;
+  long content_length = 0;
+
+  while (true) {
+    ssize_t n = recv(conn, chunk, sizeof(chunk), 0);
+    if (n <= 0) { break; }
+    in.append(chunk, n);
+    if (header_end == std::string::npos) {
+      header_end = in.find("\r\n\r\n");
+      if (header_end == std::string::npos) { continue; }
+      size_t pos = in.find("Content-Length: ");
+      if ((pos != std::string::npos) && (pos < header_end)) {
+        content_length = atol(in.c_str() + pos + 16);
+      }
+    }
+    if (in.size() >= header_end + 4 + content_length) { break; }
+  }
+  if (header_end == std::string::npos) { return; }
+
+  std::string line = in.substr(0, in.find("\r\n"));
+  size_t space1 = line.find(' ');
+  size_t space2 = line.find(' ', space1 + 1);
+  std::string method = line.substr(0, space1);
+  std::string path = line.substr(space1 + 1, space2 - space1 - 1);
+  std::string body = in.substr(header_end + 4);
+  bool length_ok = (long) body.size() == content_length;
+
+  if (options.verbose) {
+    fprintf(stderr, "%s (%zu bytes)%s\n", line.c_str(), in.size(),
+            length_ok ? "" : " length mismatch");
+  }
+  if (options.delay_ms > 0) { usleep(options.delay_ms * 1000); }
+
+  std::string response = respond(method, path, body, length_ok);
+  send(conn, response.data(), response.size(), MSG_NOSIGNAL);
+}
+
+void worker(int listen_fd, const StubServerOptions* options) {
+  while (true) {
+    int conn = accept(listen_fd, NULL, NULL);
+    if (conn < 0) { continue; }
+    int one = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    serve(conn, *options);
+    close(conn);
+  }
+}
+
+}  // namespace
+
+int stub_server_listen(StubServerOptions* options) {
+  struct sockaddr_in addr;
+  socklen_t addr_length = sizeof(addr);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+
+  if (fd < 0) { return -1; }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(options->port);
+  if ((bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) ||
+      (listen(fd, 1024) < 0) ||
+      (getsockname(fd, (struct sockaddr*) &addr, &addr_length) < 0)) {
+    close(fd);
+    return -1;
+  }
+  options->port = ntohs(addr.sin_port);
+  return fd;
+}
+
+void stub_server_run(int listen_fd, const StubServerOptions& options) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options.workers; i++) {
+    threads.push_back(std::thread(worker, listen_fd, &options));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
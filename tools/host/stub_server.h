@@ -0,0 +1,25 @@
+#ifndef stub_server_h
+#define stub_server_h
+
+// A stand-in M2X API server for host tools. It accepts the requests the
+// client library sends, checks that the body matches Content-Length and
+// is well formed JSON, and answers like M2X does.
+struct StubServerOptions {
+  // TCP port to listen on, 0 picks a free one
+  int port;
+  // Threads serving connections
+  int workers;
+  // Delay before each response, in milliseconds
+  int delay_ms;
+  // Print each request line to stderr
+  bool verbose;
+};
+
+// Binds the listening socket and returns it, or -1 on failure. The port
+// actually used is stored in +options->port+.
+int stub_server_listen(StubServerOptions* options);
+
+// Serves requests on +listen_fd+ forever
+void stub_server_run(int listen_fd, const StubServerOptions& options);
+
+#endif  /* stub_server_h */